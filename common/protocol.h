@@ -27,6 +27,16 @@
 // 0x60 release
 // 0x70 kill
 // 0x8n retrigger envelope
+// 0x9n data[8]: write chunk n of the staging patch
+// 0xa0 address value: write step sequence data
+// 0xbn step1 step2: advance step sequencer. n is a combination of StepFlags
+// 0xcn address data[n + 1]: write n + 1 consecutive bytes of patch data
+// 0xdn address data[n + 1]: write n + 1 consecutive bytes of part data
+// 0xen address data[n + 1]: write n + 1 consecutive bytes of sequence data
+// 0xf0 copy the staging patch to the active patch
+// 0xf1 get the first byte of a snapshot of the runtime statistics
+// 0xf2 get the next byte of the statistics snapshot
+// 0xf3 reset the runtime statistics
 // 0xf8 reset all controllers
 // 0xf9 reset
 // 0xfa lights out
@@ -58,6 +68,19 @@ enum ProtocolCommands {
   COMMAND_KILL = 0x70,
   
   COMMAND_RETRIGGER_ENVELOPE = 0x80,
+  COMMAND_WRITE_PATCH_CHUNK = 0x90,
+  
+  COMMAND_WRITE_SEQUENCE_DATA = 0xa0,
+  COMMAND_STEP = 0xb0,
+  
+  COMMAND_WRITE_PATCH_RANGE = 0xc0,
+  COMMAND_WRITE_PART_RANGE = 0xd0,
+  COMMAND_WRITE_SEQUENCE_RANGE = 0xe0,
+  
+  COMMAND_COMMIT_PATCH = 0xf0,
+  COMMAND_GET_STATS = 0xf1,
+  COMMAND_GET_NEXT_STATS_BYTE = 0xf2,
+  COMMAND_RESET_STATS = 0xf3,
   
   COMMAND_RESET_ALL_CONTROLLERS = 0xf8,
   COMMAND_RESET = 0xf9,
@@ -69,6 +92,69 @@ enum ProtocolCommands {
   COMMAND_SYNC = 0xff
 };
 
+enum StepFlags {
+  STEP_FLAG_SEQUENCE_1 = 1,
+  STEP_FLAG_SEQUENCE_2 = 2,
+  STEP_FLAG_ARPEGGIATOR_GATE = 4
+};
+
+// Two step sequences of 16 steps are mirrored on the voicecards.
+static constexpr uint8_t kSequenceDataSize = 32;
+
+// The patch is transferred by chunks of 8 bytes, so that other commands (notes)
+// can be sent in between.
+static constexpr uint8_t kPatchChunkSize = 8;
+static constexpr uint8_t kNumPatchChunks = 14;
+
+// Range writes carry up to 16 consecutive bytes, preceded by their address.
+static constexpr uint8_t kMaxRangeSize = 16;
+static constexpr uint8_t kMaxCommandArgumentsSize = kMaxRangeSize + 1;
+
+// Number of bytes following a command byte.
+static inline uint8_t CommandArgumentsSize(uint8_t command) {
+  switch (command & 0xf0) {
+    case COMMAND_WRITE_PATCH_CHUNK:
+      return kPatchChunkSize;
+    case COMMAND_WRITE_PATCH_RANGE:
+    case COMMAND_WRITE_PART_RANGE:
+    case COMMAND_WRITE_SEQUENCE_RANGE:
+      return (command & 0x0f) + 2;
+    case COMMAND_NOTE_ON:
+      return 3;
+    case COMMAND_WRITE_PATCH_DATA:
+    case COMMAND_WRITE_PART_DATA:
+    case COMMAND_WRITE_MOD_MATRIX:
+    case COMMAND_WRITE_SEQUENCE_DATA:
+    case COMMAND_STEP:
+      return 2;
+    case COMMAND_WRITE_LFO:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Runtime statistics of a voicecard, read byte by byte with
+// COMMAND_GET_STATS and COMMAND_GET_NEXT_STATS_BYTE. Voicecards with an older
+// firmware answer 0xff to everything.
+struct VoicecardStats {
+  // Number of samples for which the audio buffer was empty. Saturates at
+  // 0xffff.
+  uint16_t num_underruns;
+  // Maximum number of bytes waiting in the SPI input buffer, and number of
+  // bytes received while it was full.
+  uint8_t rx_high_water_mark;
+  uint8_t rx_overflows;
+  // Maximum duration of the rendering of an audio block, in samples. It must
+  // stay below the block size.
+  uint8_t max_block_duration;
+  uint8_t block_size;
+  // Number of commands processed.
+  uint16_t num_commands;
+};
+
+static constexpr uint8_t kVoicecardStatsSize = sizeof(VoicecardStats);
+
 enum SlaveId {
   SLAVE_ID_SOLO_VOICECARD = 0x01,
   SLAVE_ID_LAST
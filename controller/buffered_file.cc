@@ -0,0 +1,139 @@
+// Copyright 2011 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Block buffer in front of a file.
+
+#include "controller/buffered_file.h"
+
+#include <string.h>
+
+namespace ambika {
+
+using namespace avrlib;
+
+/* <static> */
+File* BufferedFile::file_;
+uint8_t BufferedFile::buffer_[kBufferedFileBlockSize];
+uint8_t BufferedFile::position_;
+uint8_t BufferedFile::size_;
+uint8_t BufferedFile::checksum_;
+/* </static> */
+
+static uint8_t Sum(const uint8_t* data, uint8_t size) {
+  uint8_t s = 0;
+  while (size--) {
+    s += *data++;
+  }
+  return s;
+}
+
+/* static */
+void BufferedFile::Fill() {
+  uint16_t read = 0;
+  file_->Read(buffer_, kBufferedFileBlockSize, &read);
+  size_ = read;
+  position_ = 0;
+}
+
+/* static */
+uint16_t BufferedFile::Read(void* data, uint16_t size) {
+  uint8_t* destination = static_cast<uint8_t*>(data);
+  uint16_t read = 0;
+  // Written data might still be in the buffer.
+  Flush();
+  while (read < size) {
+    if (position_ == size_) {
+      Fill();
+      if (!size_) {
+        break;
+      }
+    }
+    uint8_t available = size_ - position_;
+    if (available > size - read) {
+      available = size - read;
+    }
+    memcpy(destination + read, buffer_ + position_, available);
+    checksum_ += Sum(buffer_ + position_, available);
+    position_ += available;
+    read += available;
+  }
+  return read;
+}
+
+/* static */
+void BufferedFile::Skip(uint32_t size) {
+  // Pending writes are committed first; the skip then seeks past them.
+  Flush();
+  uint8_t available = size_ - position_;
+  if (size <= available) {
+    position_ += size;
+  } else {
+    Seek(tell() + size);
+  }
+}
+
+/* static */
+void BufferedFile::Seek(uint32_t position) {
+  Flush();
+  // Read the whole block containing the target position.
+  file_->Seek(position & ~static_cast<uint32_t>(kBufferedFileBlockSize - 1));
+  Fill();
+  position_ = position & (kBufferedFileBlockSize - 1);
+  if (position_ > size_) {
+    position_ = size_;
+  }
+}
+
+/* static */
+void BufferedFile::Write(const void* data, uint16_t size) {
+  const uint8_t* source = static_cast<const uint8_t*>(data);
+  if (size_) {
+    // The buffer holds a block read from the file: write from the current
+    // read position rather than at the end of this block.
+    file_->Seek(tell());
+    position_ = 0;
+    size_ = 0;
+  }
+  while (size) {
+    uint8_t room = kBufferedFileBlockSize - position_;
+    if (room > size) {
+      room = size;
+    }
+    memcpy(buffer_ + position_, source, room);
+    checksum_ += Sum(source, room);
+    position_ += room;
+    source += room;
+    size -= room;
+    if (position_ == kBufferedFileBlockSize) {
+      Flush();
+    }
+  }
+}
+
+/* static */
+FilesystemStatus BufferedFile::Flush() {
+  FilesystemStatus s = FS_OK;
+  // A block read from the file is left untouched.
+  if (writing()) {
+    uint16_t written;
+    s = file_->Write(buffer_, position_, &written);
+    position_ = 0;
+  }
+  return s;
+}
+
+}  // namespace ambika
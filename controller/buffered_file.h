@@ -0,0 +1,98 @@
+// Copyright 2011 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Block buffer in front of a file, so that the RIFF code can read and write
+// its small headers from memory rather than through the filesystem layer.
+
+#ifndef CONTROLLER_BUFFERED_FILE_H_
+#define CONTROLLER_BUFFERED_FILE_H_
+
+#include "avrlib/base.h"
+
+#include "avrlib/filesystem/file.h"
+
+namespace ambika {
+
+using avrlib::FilesystemStatus;
+
+// Reads after a Seek() are done by whole blocks, aligned on the block size.
+// This size divides the 512 bytes of a SD card sector, so such a block never
+// straddles two sectors. Writes start at the current position of the file and
+// are not aligned.
+static const uint8_t kBufferedFileBlockSize = 64;
+
+class BufferedFile {
+ public:
+  BufferedFile() { }
+  
+  static void Init(avrlib::File* file) {
+    file_ = file;
+    Rewind();
+  }
+  
+  // Must be called after the file has been opened, or after the file itself
+  // has been seeked.
+  static inline void Rewind() {
+    position_ = 0;
+    size_ = 0;
+  }
+  
+  static uint16_t Read(void* data, uint16_t size);
+  static void Skip(uint32_t size);
+  static void Seek(uint32_t position);
+  static inline uint32_t tell() {
+    return file_->tell() - size_ + position_;
+  }
+  static inline uint8_t eof() {
+    return position_ == size_ && file_->eof();
+  }
+  
+  // Writes at the position of the last Read, Skip or Seek, if any.
+  static void Write(const void* data, uint16_t size);
+  // Must be called before the file is closed. Does nothing if the buffer
+  // does not hold written data.
+  static FilesystemStatus Flush();
+  
+  // Sum of all the bytes read or written since the last reset. Skipped bytes
+  // are not included.
+  static inline void ResetChecksum() {
+    checksum_ = 0;
+  }
+  static inline uint8_t checksum() {
+    return checksum_;
+  }
+  
+ private:
+  static void Fill();
+  static inline uint8_t writing() {
+    return !size_ && position_;
+  }
+   
+  static avrlib::File* file_;
+  static uint8_t buffer_[kBufferedFileBlockSize];
+  // Read or write position in the buffer.
+  static uint8_t position_;
+  // Number of bytes read in the buffer. 0 while writing.
+  static uint8_t size_;
+  static uint8_t checksum_;
+  
+  DISALLOW_COPY_AND_ASSIGN(BufferedFile);
+};
+
+}  // namespace ambika
+
+#endif  // CONTROLLER_BUFFERED_FILE_H_
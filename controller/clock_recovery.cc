@@ -0,0 +1,114 @@
+// Copyright 2011 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Clock recovery.
+
+#include "controller/clock_recovery.h"
+
+namespace ambika {
+
+// The period is corrected by 1/8th of the phase error on each tick, and the
+// predicted position of the next tick by 1/2 of it. MIDI jitter caused by
+// other messages (about 1ms for a 3 bytes message) is mostly averaged out
+// after a couple of beats, while a tempo change is followed within a beat.
+static const uint8_t kPeriodCorrectionShift = 3;
+static const uint8_t kPhaseCorrectionShift = 1;
+
+/* static */
+volatile uint16_t ClockRecovery::now_;
+
+/* static */
+uint8_t ClockRecovery::state_ = STATE_IDLE;
+
+/* static */
+uint16_t ClockRecovery::last_tick_;
+
+/* static */
+uint16_t ClockRecovery::next_tick_;
+
+/* static */
+uint32_t ClockRecovery::period_;
+
+/* static */
+uint16_t ClockRecovery::lfo_scale_;
+
+/* static */
+uint16_t ClockRecovery::phase_scale_;
+
+/* static */
+void ClockRecovery::Clock() {
+  uint16_t now = ClockRecovery::now();
+  if (state_ == STATE_IDLE) {
+    state_ = STATE_FIRST_TICK;
+  } else if (state_ == STATE_FIRST_TICK) {
+    Lock(now, now - last_tick_);
+  } else {
+    int16_t error = now - next_tick_;
+    int16_t period = period_ >> 8;
+    if (error > period || error < -period) {
+      // The clock has stopped or the tempo has jumped: start again from the
+      // last measured interval.
+      Lock(now, now - last_tick_);
+    } else {
+      int32_t correction = error;
+      period_ += correction << (8 - kPeriodCorrectionShift);
+      next_tick_ += (error >> kPhaseCorrectionShift) + (period_ >> 8);
+      UpdateScales();
+    }
+  }
+  last_tick_ = now;
+}
+
+/* static */
+void ClockRecovery::Sync(uint16_t period) {
+  uint16_t now = ClockRecovery::now();
+  Lock(now, period);
+  last_tick_ = now;
+}
+
+/* static */
+uint8_t ClockRecovery::phase() {
+  uint16_t elapsed = now() - last_tick_;
+  uint32_t phase = static_cast<uint32_t>(elapsed) * phase_scale_ >> 16;
+  return phase > 255 ? 255 : phase;
+}
+
+/* static */
+void ClockRecovery::Lock(uint16_t now, uint16_t period) {
+  state_ = STATE_LOCKED;
+  period_ = static_cast<uint32_t>(period) << 8;
+  next_tick_ = now + period;
+  UpdateScales();
+}
+
+/* static */
+void ClockRecovery::UpdateScales() {
+  // Below this period, the LFO scale would not fit on 16 bits. That would be
+  // a clock at about 15000 BPM.
+  uint16_t period = period_ >> 8;
+  if (period <= kControlRate) {
+    period = kControlRate + 1;
+  }
+  lfo_scale_ = (static_cast<uint32_t>(kControlRate) << 16) / period;
+  uint32_t phase_scale = 0x1000000UL / period;
+  phase_scale_ = phase_scale > 0xffff ? 0xffff : phase_scale;
+}
+
+/* extern */
+ClockRecovery clock_recovery;
+
+}  // namespace ambika
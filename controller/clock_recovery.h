@@ -0,0 +1,99 @@
+// Copyright 2011 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Clock recovery. Incoming MIDI clock ticks are timestamped with the tick
+// counter of the multi, and a PLL keeps track of a smoothed tick period and of
+// the time at which the next tick is expected. Everything is expressed in
+// ticks of the multi (kSampleRate / 8, about 39kHz).
+
+#ifndef CONTROLLER_CLOCK_RECOVERY_H_
+#define CONTROLLER_CLOCK_RECOVERY_H_
+
+#include "avrlib/base.h"
+
+#include "controller/controller.h"
+
+namespace ambika {
+
+class ClockRecovery {
+ public:
+  ClockRecovery() { }
+  
+  // Called from the timer interrupt, at the same rate as Multi::Tick.
+  static inline void Tick() {
+    ++now_;
+  }
+  
+  // Called for each incoming MIDI clock tick.
+  static void Clock();
+  
+  // Called for each internal clock tick, with the duration of the next tick.
+  // The internal clock is exact, so the PLL is bypassed.
+  static void Sync(uint16_t period);
+  
+  static inline uint8_t locked() { return state_ == STATE_LOCKED; }
+  static inline uint16_t period() { return period_ >> 8; }
+  static inline uint16_t next_tick() { return next_tick_; }
+  static inline uint16_t now() {
+    // The counter is incremented by an interrupt; read it until we get two
+    // identical values to make sure the two bytes match.
+    uint16_t t;
+    do {
+      t = now_;
+    } while (t != now_);
+    return t;
+  }
+  
+  // Position in the current tick, from 0 to 255.
+  static uint8_t phase();
+  
+  // Converts a phase increment per clock tick into a phase increment per LFO
+  // refresh. This used to be a division for each LFO on each tick.
+  static inline uint16_t ScaleIncrement(uint16_t increment_per_tick) {
+    return static_cast<uint32_t>(increment_per_tick) * lfo_scale_ >> 16;
+  }
+  
+ private:
+  enum State {
+    STATE_IDLE,
+    STATE_FIRST_TICK,
+    STATE_LOCKED
+  };
+  
+  static void Lock(uint16_t now, uint16_t period);
+  static void UpdateScales();
+  
+  static volatile uint16_t now_;
+  
+  static uint8_t state_;
+  static uint16_t last_tick_;
+  static uint16_t next_tick_;
+  // Smoothed tick period, with 8 bits of fractional part.
+  static uint32_t period_;
+  
+  // kControlRate * 65536 / period, and 65536 * 256 / period.
+  static uint16_t lfo_scale_;
+  static uint16_t phase_scale_;
+
+  DISALLOW_COPY_AND_ASSIGN(ClockRecovery);
+};
+
+extern ClockRecovery clock_recovery;
+
+}  // namespace ambika
+
+#endif  // CONTROLLER_CLOCK_RECOVERY_H_
@@ -15,6 +15,7 @@
 
 
 #include <avr/interrupt.h>
+#include <util/delay_basic.h>
 
 #include "avrlib/boot.h"
 #include "avrlib/serial.h"
@@ -22,6 +23,8 @@
 
 #include "controller/midi_dispatcher.h"
 #include "controller/multi.h"
+#include "controller/parameter.h"
+#include "controller/profiler.h"
 #include "controller/resources.h"
 #include "controller/storage.h"
 #include "controller/system_settings.h"
@@ -55,9 +58,20 @@ inline void FlushMidiOut() {
 }
 
 inline void PollMidiIn() {
-  if (midi_io.readable()) {
-    midi_in_buffer.NonBlockingWrite(midi_io.ImmediateRead());
+  // Drain all the bytes received by the UART since the last tick.
+  while (midi_io.readable()) {
+    // The overrun flag must be read before the data register.
+    if (UCSR0A & _BV(DOR0)) {
+      midi_dispatcher.CountInputOverrun();
+    }
+    uint8_t byte = midi_io.ImmediateRead();
+    if (midi_in_buffer.writable()) {
+      midi_in_buffer.Overwrite(byte);
+    } else {
+      midi_dispatcher.CountDroppedInputByte();
+    }
   }
+  midi_dispatcher.UpdateInputHighWaterMark(midi_in_buffer.readable());
 }
 
 // This timer is responsible for:
@@ -77,6 +91,14 @@ ISR(TIMER1_OVF_vect, ISR_NOBLOCK) {
     cycle = 0;
     storage.Tick();
   }
+  // Timer 1 counts every 8 cycles: the two readings must be at least 8 cycles
+  // apart to differ, otherwise a falling counter would pass for a rising one.
+  uint8_t first = TCNT1L;
+  _delay_loop_1(3);
+  uint8_t second = TCNT1L;
+  profiler.Record(
+      PROFILER_TIMER1_ISR,
+      Profiler::elapsed_counts(first, second) << 3);
 }
 
 // This timer is responsible for keeping track of time for the internal clock,
@@ -84,6 +106,27 @@ ISR(TIMER1_OVF_vect, ISR_NOBLOCK) {
 ISR(TIMER2_OVF_vect) {
   multi.Tick();
   voicecard_tx.SendBytes();
+  if (profiler.sample_timer2()) {
+    uint8_t first = TCNT2;
+    uint8_t second = TCNT2;
+    profiler.Record(
+        PROFILER_TIMER2_ISR,
+        Profiler::elapsed_counts(first, second));
+  }
+}
+
+// Also called by the storage code between two SD card transfers.
+void ProcessMidiAndClocks() {
+  // Do some MIDI.
+  profiler.Begin(PROFILER_MIDI);
+  while (midi_in_buffer.readable()) {
+    midi_parser.PushByte(midi_in_buffer.ImmediateRead());
+  }
+  profiler.End(PROFILER_MIDI);
+  // Do some LFOs and clocks.
+  profiler.Begin(PROFILER_CLOCKS);
+  multi.UpdateClocks();
+  profiler.End(PROFILER_CLOCKS);
 }
 
 void Init() {
@@ -92,6 +135,7 @@ void Init() {
   UCSR1B = 0;
   ResetWatchdog();
   Gpio<PortC, 0>::set_mode(DIGITAL_OUTPUT);
+  profiler.Reset();
   system_settings.Init(false);
   midi_io.Init();
   
@@ -115,19 +159,19 @@ void Init() {
   multi.Init(ui.shifted());
 
   storage.Init();
+  storage.set_yield_fn(&ProcessMidiAndClocks);
+  storage.LoadPerformanceSet();
 }
 
 int main() {
   Init();
   ui.FlushEvents();
   while (1) {
-    // Do some MIDI.
-    while (midi_in_buffer.readable()) {
-      midi_parser.PushByte(midi_in_buffer.ImmediateRead());
-    }
-    // Do some LFOs and clocks.
-    multi.UpdateClocks();
+    ProcessMidiAndClocks();
+    midi_dispatcher.ProcessPendingProgramChange();
     // Do some display.
+    profiler.Begin(PROFILER_UI);
     ui.DoEvents();
+    profiler.End(PROFILER_UI);
   }
 }
@@ -41,7 +41,20 @@ typedef Gpio<PortC, 1> EncoderClickLine;
 
 // MIDI
 typedef avrlib::Serial<SerialPort0, 31250, avrlib::POLLED, avrlib::POLLED> MidiIO;
+#ifdef MIDI_IN_BUFFER_SIZE
+// Larger input buffer, for dense SysEx or clock + CC streams. The size must be
+// a power of 2.
+struct MidiInBufferSpecs {
+  enum {
+    buffer_size = MIDI_IN_BUFFER_SIZE,
+    data_size = 8,
+  };
+  typedef avrlib::DataTypeForSize<data_size>::Type Value;
+};
+typedef RingBuffer<MidiInBufferSpecs> MidiBuffer;
+#else
 typedef RingBuffer<SerialInput<SerialPort0> > MidiBuffer;
+#endif  // MIDI_IN_BUFFER_SIZE
 
 // LCD
 static const uint8_t kLcdWidth = 40;
@@ -28,19 +28,62 @@ uint8_t MidiDispatcher::current_bank_ = 0;
 /* static */
 uint8_t MidiDispatcher::current_parameter_address_ = 0xff;
 /* static */
+uint8_t MidiDispatcher::current_parameter_channel_ = 0xff;
+/* static */
+uint8_t MidiDispatcher::running_status_ = 0;
+/* static */
 uint8_t MidiDispatcher::data_entry_counter_ = 0;
+/* static */
+uint16_t MidiDispatcher::pending_program_changes_;
+/* static */
+uint8_t MidiDispatcher::pending_program_[16];
+
+/* static */
+uint16_t MidiDispatcher::input_overruns_;
+/* static */
+uint16_t MidiDispatcher::input_dropped_bytes_;
+/* static */
+uint8_t MidiDispatcher::input_high_water_mark_;
 
 MidiDispatcher midi_dispatcher;
 
 
+/* static */
+void MidiDispatcher::ResetInputStats() {
+  input_overruns_ = 0;
+  input_dropped_bytes_ = 0;
+  input_high_water_mark_ = 0;
+}
+
 /* static */
 void MidiDispatcher::SendBlocking(uint8_t byte) {
+  running_status_ = 0;
   OutputBufferLowPriority::Write(byte);
 }
 
+/* static */
+void MidiDispatcher::SendStatus(uint8_t status) {
+  // Realtime messages can be inserted anywhere without cancelling the running
+  // status - this is why the clock can use the high priority buffer. SysEx and
+  // system common messages cancel it. When the buffer is about to overflow,
+  // the status byte is sent again, in case the oldest one gets overwritten.
+  if (status != running_status_ ||
+      OutputBufferLowPriority::writable() < 3) {
+    OutputBufferLowPriority::Overwrite(status);
+  }
+  if (status < 0xf8) {
+    running_status_ = status < 0xf0 ? status : 0;
+  }
+}
+
 /* static */
 void MidiDispatcher::Send(uint8_t status, uint8_t* data, uint8_t size) {
-  OutputBufferLowPriority::Overwrite(status);
+  if (status & 0x80) {
+    SendStatus(status);
+  } else {
+    // SysEx data byte.
+    OutputBufferLowPriority::Overwrite(status);
+  }
   if (size) {
     OutputBufferLowPriority::Overwrite(*data++);
     --size;
@@ -58,7 +101,7 @@ void MidiDispatcher::SendNow(uint8_t byte) {
 
 /* static */
 void MidiDispatcher::Send3(uint8_t status, uint8_t a, uint8_t b) {
-  OutputBufferLowPriority::Overwrite(status);
+  SendStatus(status);
   OutputBufferLowPriority::Overwrite(a);
   OutputBufferLowPriority::Overwrite(b);
 }
@@ -106,11 +106,21 @@ class MidiDispatcher : public midi::MidiDevice {
   }
   
   static void ProgramChange(uint8_t channel, uint8_t program) {
+    if (storage.busy()) {
+      // A storage operation is in progress. Load the program once it is done.
+      // The last program change received on each channel is kept.
+      pending_program_changes_ |= U16(1) << channel;
+      pending_program_[channel] = program;
+      return;
+    }
     if (system_settings.rx_program_change()) {
       for (uint8_t retry = 0; retry < 2; ++retry) {
         bool error = false;
         if (current_bank_ < 26) {
-          for (uint8_t i = 0; i < kNumParts; ++i) {
+          // The program is read only once, by the first part listening on
+          // this channel, and then copied to the others.
+          uint8_t source_part = 0xff;
+          for (uint8_t i = 0; i < kNumParts && !error; ++i) {
             if (multi.data().part_mapping(i).receive_channel(channel)) {
               StorageLocation* location = Library::mutable_location();
               location->object = STORAGE_OBJECT_PROGRAM;
@@ -118,11 +128,14 @@ class MidiDispatcher : public midi::MidiDevice {
               location->part = i;
               location->bank = current_bank_;
               location->slot = program;
+              if (source_part == 0xff) {
+                error = storage.Load(*location) != FS_OK;
+                source_part = i;
+              } else {
+                storage.CopyProgram(source_part, *location);
+              }
               if (!error) {
-                error = error | (storage.Load(*location) != FS_OK);
-                if (!error) {
-                  Library::SaveLocation();
-                }
+                Library::SaveLocation();
               }
             }
           }
@@ -147,6 +160,20 @@ class MidiDispatcher : public midi::MidiDevice {
     }
   }
   
+  static void ProcessPendingProgramChange() {
+    if (!pending_program_changes_) {
+      return;
+    }
+    uint16_t mask = 1;
+    for (uint8_t channel = 0; channel < 16; ++channel) {
+      if (pending_program_changes_ & mask) {
+        pending_program_changes_ &= ~mask;
+        ProgramChange(channel, pending_program_[channel]);
+      }
+      mask <<= 1;
+    }
+  }
+  
   static void Reset() { multi.Reset(); }
   static void Clock() { 
     if (!multi.internal_clock()) {
@@ -192,6 +219,7 @@ class MidiDispatcher : public midi::MidiDevice {
   
   static void RawByte(uint8_t byte) {
     if (mode() == MIDI_OUT_THRU) {
+      running_status_ = 0;
       OutputBufferLowPriority::Overwrite(byte);
     }
   }
@@ -212,6 +240,29 @@ class MidiDispatcher : public midi::MidiDevice {
     return OutputBufferLowPriority::ImmediateRead();
   }
   
+  // Statistics about the MIDI input, updated by the MIDI input polling.
+  static inline void CountInputOverrun() {
+    if (input_overruns_ != 0xffff) {
+      ++input_overruns_;
+    }
+  }
+  static inline void CountDroppedInputByte() {
+    if (input_dropped_bytes_ != 0xffff) {
+      ++input_dropped_bytes_;
+    }
+  }
+  static inline void UpdateInputHighWaterMark(uint8_t size) {
+    if (size > input_high_water_mark_) {
+      input_high_water_mark_ = size;
+    }
+  }
+  static inline uint16_t input_overruns() { return input_overruns_; }
+  static inline uint16_t input_dropped_bytes() { return input_dropped_bytes_; }
+  static inline uint8_t input_high_water_mark() {
+    return input_high_water_mark_;
+  }
+  static void ResetInputStats();
+  
   
   // ------ Generation of MIDI out messages ------------------------------------
   static inline void OnNote(Part* part, uint8_t note, uint8_t velocity) {
@@ -267,10 +318,14 @@ class MidiDispatcher : public midi::MidiDevice {
     }
     uint8_t channel = multi.part_channel(part);
     ++data_entry_counter_;
-    if (current_parameter_address_ != address || data_entry_counter_ >= 32) {
+    // The NRPN address is remembered by the receiver for each channel.
+    if (current_parameter_address_ != address ||
+        current_parameter_channel_ != channel ||
+        data_entry_counter_ >= kDataEntryResendRate) {
       Send3(byteOr(channel, 0xb0), midi::kNrpnMsb, msb(address));
       Send3(byteOr(channel, 0xb0), midi::kNrpnLsb, U7(address));
       current_parameter_address_ = address;
+      current_parameter_channel_ = channel;
       data_entry_counter_ = 0;
     }
     Send3(byteOr(channel, 0xb0), midi::kDataEntryMsb, msb(value));
@@ -286,6 +341,7 @@ class MidiDispatcher : public midi::MidiDevice {
 
  private:
   static void Send(uint8_t status, uint8_t* data, uint8_t size);
+  static void SendStatus(uint8_t status);
   static void SendNow(uint8_t byte);
   static uint8_t mode() { return system_settings.data().midi_out_mode(); }
   static void ProcessSysEx(uint8_t byte) {
@@ -298,6 +354,18 @@ class MidiDispatcher : public midi::MidiDevice {
   static uint8_t current_bank_;
   static uint8_t data_entry_counter_;
   static uint8_t current_parameter_address_;
+  static uint8_t current_parameter_channel_;
+  // Status byte of the last channel message written in the low priority
+  // buffer, 0 when the next message must be sent with its status byte.
+  static uint8_t running_status_;
+  // One bit per channel with a program change waiting for the end of a
+  // storage operation.
+  static uint16_t pending_program_changes_;
+  static uint8_t pending_program_[16];
+  
+  static uint16_t input_overruns_;
+  static uint16_t input_dropped_bytes_;
+  static uint8_t input_high_water_mark_;
   
   DISALLOW_COPY_AND_ASSIGN(MidiDispatcher);
 };
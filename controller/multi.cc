@@ -16,6 +16,8 @@
 #include "controller/midi_dispatcher.h"
 #include "controller/multi.h"
 
+#include <string.h>
+
 #include "controller/resources.h"
 
 namespace ambika {
@@ -31,12 +33,25 @@ uint16_t Multi::lfo_refresh_counter_ = 0;
 uint8_t Multi::lfo_refresh_cycle_ = 0;
 volatile uint8_t Multi::num_clock_events_;
 uint16_t Multi::tick_duration_;
+uint16_t Multi::tick_duration_fraction_;
+uint16_t Multi::clock_fraction_;
+uint32_t Multi::base_tick_duration_;
 uint8_t Multi::tick_count_;
 uint8_t Multi::step_count_;
 uint8_t Multi::running_;
+uint8_t Multi::lookahead_;
+uint8_t Multi::preroll_pending_;
 uint8_t Multi::idle_ticks_;
-uint16_t Multi::tick_duration_table_[kNumStepsInGroovePattern];
 uint8_t Multi::flags_;
+
+/* static */
+uint8_t Multi::channel_parts_[16];
+
+/* static */
+uint8_t Multi::keyrange_low_[kNumParts];
+
+/* static */
+uint8_t Multi::keyrange_span_[kNumParts];
 /* </static> */
 
 static constexpr MultiData::Parameters init_settings PROGMEM {
@@ -123,30 +138,51 @@ void Multi::AssignVoicesToParts() {
 
 /* static */
 void Multi::Touch() {
-  ComputeInternalClockOverflowsTable();
+  ComputeInternalClockTickDuration();
+  UpdateChannelMapping();
   SolveAllocationConflicts(-1);
   AssignVoicesToParts();
   flags_ = FLAG_HAS_CHANGE;
 }
 
-const int32_t kTempoFactor = (4 * kSampleRateNum * 60L / 24L / kSampleRateDen);
+// A clock tick lasts 60 / 24 / bpm seconds. With the tempo expressed in
+// tenths of BPM, this is kTickDurationFactor / (kSampleRateDen * tempo)
+// samples.
+const uint32_t kTickDurationFactor = kSampleRateNum * 60L * 10L / 24L;
 
 /* static */
-void Multi::ComputeInternalClockOverflowsTable() {
-  static_assert(kTempoFactor == 392156L);
-
-  int32_t rounding = 2 * data_.clock_bpm();
-  int32_t denominator = 4 * data_.clock_bpm();
-  int16_t base_tick_duration = (kTempoFactor + rounding) / denominator;
-  for (uint8_t i = 0; i < kNumStepsInGroovePattern; ++i) {
-    int32_t swing_direction = ResourcesManager::Lookup<int16_t, uint8_t>(
-        LUT_RES_GROOVE_SWING + data_.clock_groove_template(), i);
-    swing_direction *= base_tick_duration;
-    swing_direction *= data_.clock_groove_amount();
-    int16_t swing = highWord(swing_direction);
-    tick_duration_table_[i] = base_tick_duration + swing;
+void Multi::ComputeInternalClockTickDuration() {
+  static_assert(kTickDurationFactor == 50000000L);
+  
+  uint8_t fine = data_.clock_bpm_fine();
+  if (fine > 9) {
+    fine = 9;
+  }
+  uint32_t denominator = (data_.clock_bpm() * 10 + fine) * kSampleRateDen;
+  // 16.16 division, done 8 bits at a time so that the remainder does not
+  // overflow.
+  uint32_t duration = kTickDurationFactor / denominator;
+  uint32_t remainder = kTickDurationFactor % denominator;
+  for (uint8_t i = 0; i < 2; ++i) {
+    remainder <<= 8;
+    duration = (duration << 8) | (remainder / denominator);
+    remainder %= denominator;
   }
-  tick_duration_ = tick_duration_table_[0];
+  base_tick_duration_ = duration;
+  UpdateTickDuration();
+}
+
+/* static */
+void Multi::UpdateTickDuration() {
+  // The swing is kept with its fractional part, so that the groove template
+  // does not change the average tempo.
+  int32_t swing = ResourcesManager::Lookup<int16_t, uint8_t>(
+      LUT_RES_GROOVE_SWING + data_.clock_groove_template(), step_count_);
+  swing *= static_cast<uint16_t>(base_tick_duration_ >> 16);
+  swing *= data_.clock_groove_amount();
+  uint32_t duration = base_tick_duration_ + swing;
+  tick_duration_ = duration >> 16;
+  tick_duration_fraction_ = duration;
 }
 
 /* static */
@@ -160,19 +196,40 @@ void Multi::Clock() {
     if (step_count_ == kNumStepsInGroovePattern) {
       step_count_ = 0;
     }
-    tick_duration_ = tick_duration_table_[step_count_];
+    UpdateTickDuration();
+  }
+  
+  if (internal_clock()) {
+    clock_recovery.Sync(tick_duration_);
+  } else {
+    clock_recovery.Clock();
   }
   
   if (running_)  {
     // Advance the clock of all parts, and check if some of them are idle.
     midi_dispatcher.OnClock();
+    // When the parts are clocked ahead, the notes of this tick have already
+    // been computed - unless the pre-roll has not been done yet.
+    uint8_t clock_parts = !lookahead_ || preroll_pending_;
+    preroll_pending_ = 0;
+    if (lookahead_ && !CanLookAhead()) {
+      // The clock source or the MIDI out mode has changed while running.
+      lookahead_ = 0;
+      voicecard_tx.ReleaseScheduled();
+    }
     uint8_t idle = 1;
     for (uint8_t i = 0; i < kNumParts; ++i) {
-      parts_[i].Clock();
+      if (clock_parts) {
+        parts_[i].Clock();
+      }
+      parts_[i].ClockLfos();
       if (parts_[i].num_pressed_keys() > 0) {
         idle = 0;
       }
     }
+    if (lookahead_) {
+      ClockParts();
+    }
     // No key is being pressed on any part. It looks like we are counting beats
     // for nothing...
     if (internal_clock()) {
@@ -197,17 +254,51 @@ void Multi::Start() {
   for (uint8_t i = 0; i < kNumParts; ++i) {
     parts_[i].Start();
   }
-  tick_duration_ = tick_duration_table_[0];
+  UpdateTickDuration();
   running_ = 1;
+  lookahead_ = CanLookAhead();
+  // The notes of the first tick are computed by UpdateClocks, once the note
+  // which has started the clock has reached the parts.
+  preroll_pending_ = lookahead_;
+}
+
+/* static */
+uint8_t Multi::CanLookAhead() {
+  // Only the internal clock tells in advance when the next tick will be. The
+  // notes sent to the MIDI out, in sequencer mode or when the voices are
+  // chained with another unit, are not delayed to the tick: they are not
+  // computed ahead either.
+  return internal_clock() &&
+      midi_dispatcher.mode() != MIDI_OUT_SEQUENCER &&
+      midi_dispatcher.mode() != MIDI_OUT_CHAIN;
+}
+
+/* static */
+void Multi::ClockParts() {
+  // Computes the notes and steps of the next tick. The voicecard commands are
+  // held until the tick is due.
+  voicecard_tx.BeginScheduled();
+  for (uint8_t i = 0; i < kNumParts; ++i) {
+    parts_[i].Clock();
+  }
+  voicecard_tx.EndScheduled();
+  // The tick might have elapsed while the notes were computed, if the main
+  // loop is late. In this case, the commands are sent right away.
+  if (num_clock_events_ > 1) {
+    voicecard_tx.ReleaseScheduled();
+  }
 }
 
 /* static */
 void Multi::Stop() {
   midi_dispatcher.OnStop();
+  // The parts discard the notes computed for the next tick when they release
+  // their voices.
   for (uint8_t i = 0; i < kNumParts; ++i) {
     parts_[i].Stop();
   }
   running_ = 0;
+  preroll_pending_ = 0;
 }
 
 /* static */
@@ -217,6 +308,16 @@ void Multi::UpdateClocks() {
     lfo_refresh_counter_ -= kControlRate;
     for (uint8_t i = 0; i < kNumParts; ++i) {
       parts_[i].UpdateLfos(lfo_refresh_cycle_ & 1);
+      parts_[i].StreamPatch();
+    }
+  }
+  
+  if (preroll_pending_ && running_) {
+    preroll_pending_ = 0;
+    ClockParts();
+    // The first tick has already elapsed.
+    if (num_clock_events_) {
+      voicecard_tx.ReleaseScheduled();
     }
   }
   
@@ -231,6 +332,21 @@ void Multi::UpdateClocks() {
   }
 }
 
+/* static */
+void Multi::UpdateChannelMapping() {
+  memset(channel_parts_, 0, sizeof(channel_parts_));
+  for (uint8_t i = 0; i < kNumParts; ++i) {
+    const PartMapping& mapping = data_.part_mapping(i);
+    for (uint8_t channel = 0; channel < 16; ++channel) {
+      if (mapping.receive_channel(channel)) {
+        channel_parts_[channel] |= 1 << i;
+      }
+    }
+    keyrange_low_[i] = mapping.keyrange_low;
+    keyrange_span_[i] = byteAnd(mapping.keyrange_high - mapping.keyrange_low, 0x7f);
+  }
+}
+
 /* static */
 void Multi::SetValue(uint8_t address, uint8_t value) {
   auto bytes = data_.bytes();
@@ -240,9 +356,12 @@ void Multi::SetValue(uint8_t address, uint8_t value) {
     if (address < PRM_MULTI_CLOCK_BPM) {
       if (byteAnd(address, 3) == 3) {
         Touch();
+      } else {
+        UpdateChannelMapping();
       }
-    } else if (address <= PRM_MULTI_CLOCK_GROOVE_AMOUNT) {
-      ComputeInternalClockOverflowsTable();
+    } else if (address <= PRM_MULTI_CLOCK_GROOVE_AMOUNT ||
+               address == PRM_MULTI_CLOCK_BPM_FINE) {
+      ComputeInternalClockTickDuration();
     }
   }
 }
@@ -23,8 +23,10 @@
 
 #include "avrlib/base.h"
 
+#include "controller/clock_recovery.h"
 #include "controller/controller.h"
 #include "controller/part.h"
+#include "controller/voicecard_tx.h"
 
 namespace ambika {
   
@@ -77,7 +79,8 @@ struct MultiData {
     KnobAssignment knob_assignment[8];
 
     // Offset: 52-56
-    uint8_t padding2[4];
+    uint8_t clock_bpm_fine;
+    uint8_t padding2[3];
   };
 
 private:
@@ -116,6 +119,9 @@ public:
   inline uint8_t& clock_release() {
     return data.params.clock_release;
   }
+  inline uint8_t& clock_bpm_fine() {
+    return data.params.clock_bpm_fine;
+  }
 
   inline KnobAssignment& knobAssignment(uint8_t index) {
     return data.params.knob_assignment[index];
@@ -140,6 +146,10 @@ enum MultiParameter {
   PRM_MULTI_CLOCK_GROOVE_TEMPLATE,
   PRM_MULTI_CLOCK_GROOVE_AMOUNT,
   PRM_MULTI_CLOCK_LATCH,
+
+  // after the knob assignments
+  PRM_MULTI_CLOCK_BPM_FINE =
+      PRM_MULTI_CLOCK_LATCH + 1 + 8 * sizeof(KnobAssignment),
 };
 
 static const uint8_t kNumStepsInGroovePattern = 16;
@@ -173,65 +183,74 @@ class Multi {
     if (!running_) {
       Start();
     }
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).accept_channel_note(channel, note)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if ((parts & 1) && accept_note(i, note)) {
         parts_[i].NoteOn(note, velocity);
       }
     }
   }
   static void NoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {
     IGNORE_UNUSED(velocity);
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).accept_channel_note(channel, note)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if ((parts & 1) && accept_note(i, note)) {
         parts_[i].NoteOff(note);
       }
     }
   }
   static void ControlChange(uint8_t channel, uint8_t controller, uint8_t value) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).receive_channel(channel)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if (parts & 1) {
         parts_[i].ControlChange(controller, value);
       }
     }
   }
   static void PitchBend(uint8_t channel, uint16_t pitch_bend) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).receive_channel(channel)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if (parts & 1) {
         parts_[i].PitchBend(pitch_bend);
       }
     }
   }
   static void Aftertouch(uint8_t channel, uint8_t note, uint8_t velocity) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).accept_channel_note(channel, note)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if ((parts & 1) && accept_note(i, note)) {
         parts_[i].Aftertouch(note, velocity);
       }
     }
   }
   static void Aftertouch(uint8_t channel, uint8_t velocity) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).receive_channel(channel)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if (parts & 1) {
         parts_[i].Aftertouch(velocity);
       }
     }
   }
   static void AllSoundOff(uint8_t channel) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).receive_channel(channel)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if (parts & 1) {
         parts_[i].AllSoundOff();
       }
     }
   }
   static void ResetAllControllers(uint8_t channel) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).receive_channel(channel)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if (parts & 1) {
         parts_[i].ResetAllControllers();
       }
     }
   }
   static void AllNotesOff(uint8_t channel) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).receive_channel(channel)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if (parts & 1) {
         parts_[i].AllNotesOff();
       }
     }
@@ -242,6 +261,7 @@ class Multi {
         data_.part_mapping(i).midi_channel = channel + 1;
       }
     }
+    UpdateChannelMapping();
   }
   static void OmniModeOn(uint8_t channel) {
     for (uint8_t i = 0; i < kNumParts; ++i) {
@@ -249,17 +269,20 @@ class Multi {
         data_.part_mapping(i).midi_channel = 0;
       }
     }
+    UpdateChannelMapping();
   }
   static void MonoModeOn(uint8_t channel, uint8_t num_channels) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).receive_channel(channel)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if (parts & 1) {
         parts_[i].MonoModeOn(num_channels);
       }
     }
   }
   static void PolyModeOn(uint8_t channel) {
-    for (uint8_t i = 0; i < kNumParts; ++i) {
-      if (data_.part_mapping(i).receive_channel(channel)) {
+    uint8_t parts = channel_parts_[channel];
+    for (uint8_t i = 0; parts; ++i, parts >>= 1) {
+      if (parts & 1) {
         parts_[i].PolyModeOn();
       }
     }
@@ -277,11 +300,17 @@ class Multi {
   }
   
   static void Tick() {
+    ClockRecovery::Tick();
     ++clock_counter_;
     ++lfo_refresh_counter_;
     if (clock_counter_ >= tick_duration_) {
       ++num_clock_events_;
-      clock_counter_ = 0;
+      voicecard_tx.ReleaseScheduled();
+      // The fractional part of the tick duration is accumulated, and each time
+      // it overflows, the next tick lasts one more sample.
+      uint16_t fraction = clock_fraction_;
+      clock_fraction_ += tick_duration_fraction_;
+      clock_counter_ = clock_fraction_ < fraction ? 0xffff : 0;
     }
   }
   
@@ -330,7 +359,18 @@ class Multi {
   }
   
  private:
-  static void ComputeInternalClockOverflowsTable();
+  static void ComputeInternalClockTickDuration();
+  static void UpdateTickDuration();
+  static void ClockParts();
+  static uint8_t CanLookAhead();
+  // Rebuilds the channel and keyrange tables from the part mappings.
+  static void UpdateChannelMapping();
+  
+  // Keyranges are tested modulo 128, so that ranges wrapping around (low >
+  // high) need no special case.
+  static inline uint8_t accept_note(uint8_t part, uint8_t note) {
+    return byteAnd(note - keyrange_low_[part], 0x7f) <= keyrange_span_[part];
+  }
   
   // Incremented at 39kHz
   static uint16_t clock_counter_;
@@ -339,8 +379,12 @@ class Multi {
   static uint8_t lfo_refresh_cycle_;
   static volatile uint8_t num_clock_events_;
 
-  // Duration of a clock tick, in 39kHz increments.
+  // Duration of a clock tick, in 39kHz increments, and its fractional part.
   static uint16_t tick_duration_;
+  static uint16_t tick_duration_fraction_;
+  static uint16_t clock_fraction_;
+  // Duration of a clock tick without groove, 16.16 fixed point.
+  static uint32_t base_tick_duration_;
   // Incremented at each clock tick, reset after 6 ticks.
   static uint8_t tick_count_;
   // Incremented every 6 tick.
@@ -349,15 +393,23 @@ class Multi {
   static uint8_t idle_ticks_;
   // Whether the clock is started.
   static uint8_t running_;
-  // This list of tick durations is computed from the BPM and the groove
-  // template.
-  static uint16_t tick_duration_table_[kNumStepsInGroovePattern];
+  // Whether the parts are clocked one tick ahead, with their voicecard
+  // commands released by the clock interrupt.
+  static uint8_t lookahead_;
+  // Whether the notes of the first tick after Start() are still to be
+  // computed.
+  static uint8_t preroll_pending_;
   
 
   static MultiData data_;
   static Part parts_[kNumParts];
   static uint8_t flags_;
   
+  // For each MIDI channel, bitmask of the parts receiving it.
+  static uint8_t channel_parts_[16];
+  static uint8_t keyrange_low_[kNumParts];
+  static uint8_t keyrange_span_[kNumParts];
+  
   DISALLOW_COPY_AND_ASSIGN(Multi);
 };
 
@@ -63,7 +63,11 @@ static constexpr char note_names[] PROGMEM = " CC# DD# E FF# GG# AA# B";
 static constexpr char octaves[] PROGMEM = "-0123456789";
 
 
-uint8_t Parameter::Scale(uint8_t value_7bits) const {
+static uint8_t ScaleRange(
+    Unit unit,
+    uint8_t min_value,
+    uint8_t max_value,
+    uint8_t value_7bits) {
   uint8_t scaled_value;
   if (unit == UNIT_RAW_UINT8) {
     scaled_value = value_7bits;
@@ -81,21 +85,11 @@ uint8_t Parameter::Scale(uint8_t value_7bits) const {
   return scaled_value;
 }
 
-uint8_t Parameter::is_snapped(uint8_t current_value, uint8_t value_7bits) const {
-  uint8_t scaled_value = Scale(value_7bits);
-  int16_t delta;
-  if (unit == UNIT_INT8) {
-    delta = S16(S8(current_value)) - S8(scaled_value);
-  } else {
-    delta = S16(U8(current_value)) - U8(scaled_value);
-  }
-  if (delta < 0) {
-    delta = -delta;
-  }
-  return delta <= U8(max_value - min_value) >> 5u;
-}
-
-uint8_t Parameter::Clamp(uint8_t value) const {
+static uint8_t ClampRange(
+    Unit unit,
+    uint8_t min_value,
+    uint8_t max_value,
+    uint8_t value) {
   if (unit == UNIT_INT8) {
     int8_t signed_value = S8(value);
     if (signed_value < S8(min_value)) {
@@ -113,7 +107,12 @@ uint8_t Parameter::Clamp(uint8_t value) const {
   return value;
 }
 
-uint8_t Parameter::Increment(uint8_t current_value, int8_t increment) const {
+static uint8_t IncrementRange(
+    Unit unit,
+    uint8_t min_value,
+    uint8_t max_value,
+    uint8_t current_value,
+    int8_t increment) {
   int16_t value = current_value;
   uint8_t new_value = current_value;
   if (unit == UNIT_INT8) {
@@ -130,6 +129,32 @@ uint8_t Parameter::Increment(uint8_t current_value, int8_t increment) const {
   return new_value;
 }
 
+uint8_t Parameter::Scale(uint8_t value_7bits) const {
+  return ScaleRange(unit, min_value, max_value, value_7bits);
+}
+
+uint8_t Parameter::is_snapped(uint8_t current_value, uint8_t value_7bits) const {
+  uint8_t scaled_value = Scale(value_7bits);
+  int16_t delta;
+  if (unit == UNIT_INT8) {
+    delta = S16(S8(current_value)) - S8(scaled_value);
+  } else {
+    delta = S16(U8(current_value)) - U8(scaled_value);
+  }
+  if (delta < 0) {
+    delta = -delta;
+  }
+  return delta <= U8(max_value - min_value) >> 5u;
+}
+
+uint8_t Parameter::Clamp(uint8_t value) const {
+  return ClampRange(unit, min_value, max_value, value);
+}
+
+uint8_t Parameter::Increment(uint8_t current_value, int8_t increment) const {
+  return IncrementRange(unit, min_value, max_value, current_value, increment);
+}
+
 uint8_t Parameter::RandomValue() const {
   uint8_t range = max_value - min_value + 1;
   uint8_t value = Random::GetByte();
@@ -861,8 +886,19 @@ static constexpr Parameter parameters[kNumParameters] PROGMEM = {
       UNIT_INT8, -63, 63,
       1, 0, 0xff, 109,
       STR_RES_KEYBTVCF, STR_RES_KEYBTVCF, STR_RES_FILTER_1 },
+
+  // 75
+  { PARAMETER_LEVEL_MULTI,
+    PRM_MULTI_CLOCK_BPM_FINE,
+    UNIT_UINT8, 0, 9,
+    1, 0, 0xff, 0xff,
+    STR_RES_FINE, STR_RES_FINE, STR_RES_CLOCK },
 };
 
+inline uint8_t get_address(const Parameter& p, uint8_t instance_index) {
+  return p.offset + p.stride * instance_index;
+}
+
 /* static */
 Parameter ParameterManager::cached_definition_;
 
@@ -880,8 +916,77 @@ Parameter ParameterManager::dummy_parameter_ = {
 /* static */
 uint8_t ParameterManager::cached_index_ = 0xff;
 
+struct ControlChangeAddresses {
+  uint8_t address[128];
+};
+
+static constexpr ControlChangeAddresses ComputeControlChangeAddresses() {
+  ControlChangeAddresses table { };
+  for (uint8_t cc = 0; cc < 128; ++cc) {
+    table.address[cc] = 0xff;
+    uint8_t parameter_id = midi_cc_map[cc];
+    if (parameter_id == 0xff) {
+      continue;
+    }
+    const Parameter& p = parameters[parameter_id];
+    // Only patch and part parameters are mapped to CCs.
+    if (p.level > PARAMETER_LEVEL_PART) {
+      continue;
+    }
+    // Some ranges of MIDI CC point to the same parameter ID, for different
+    // instances of the same object (for example a LFO).
+    uint8_t controller = cc;
+    uint8_t instance_index = 0;
+    for (; instance_index < p.num_instances; ++instance_index) {
+      if (p.midi_cc == controller) {
+        break;
+      }
+      controller -= p.stride;
+    }
+    table.address[cc] = p.offset + p.stride * instance_index;
+  }
+  return table;
+}
+
+static constexpr ControlChangeAddresses cc_addresses PROGMEM =
+    ComputeControlChangeAddresses();
+
+/* static */
+uint8_t ParameterManager::ControlChangeToAddress(uint8_t cc) {
+  return pgm_read_byte(cc_addresses.address + cc);
+}
+
+/* static */
+ParameterRange ParameterManager::range(uint8_t parameter_id) {
+  ParameterRange r = { UNIT_UINT8, 0, 255 };
+  if (parameter_id != 0xfe) {
+    const Parameter* p = &parameters[parameter_id];
+    r.unit = static_cast<Unit>(pgm_read_byte(&p->unit));
+    r.min_value = pgm_read_byte(&p->min_value);
+    r.max_value = pgm_read_byte(&p->max_value);
+  }
+  return r;
+}
+
+/* static */
+uint8_t ParameterManager::ScaleValue(uint8_t parameter_id, uint8_t value_7bits) {
+  ParameterRange r = range(parameter_id);
+  return ScaleRange(r.unit, r.min_value, r.max_value, value_7bits);
+}
+
+/* static */
+uint8_t ParameterManager::ClampValue(uint8_t parameter_id, uint8_t value) {
+  ParameterRange r = range(parameter_id);
+  return ClampRange(r.unit, r.min_value, r.max_value, value);
+}
+
 /* static */
-void ParameterManager::Init() {
+uint8_t ParameterManager::IncrementValue(
+    uint8_t parameter_id,
+    uint8_t value,
+    int8_t increment) {
+  ParameterRange r = range(parameter_id);
+  return IncrementRange(r.unit, r.min_value, r.max_value, value, increment);
 }
 
 /* static */
@@ -906,10 +1011,6 @@ uint8_t ParameterManager::AddressToParameterId(uint8_t address) {
   return ResourcesManager::Lookup<uint8_t, uint8_t>(midi_nrpn_map, address);
 }
 
-inline uint8_t get_address(const Parameter& p, uint8_t instance_index) {
-  return p.offset + p.stride * instance_index;
-}
-
 /* static */
 void ParameterManager::SetValue(const Parameter& p,
       uint8_t part, uint8_t instance_index, uint8_t value, uint8_t user_initiated) {
@@ -109,8 +109,15 @@ struct Parameter {
   static void PrintNote(uint8_t note, char* buffer);
 };
 
+// Subset of a parameter definition needed to apply a MIDI CC or NRPN.
+struct ParameterRange {
+  Unit unit;
+  uint8_t min_value;
+  uint8_t max_value;
+};
+
 // counts parameters in Patch.h
-constexpr uint8_t kNumParameters = 75;
+constexpr uint8_t kNumParameters = 76;
 
 // The parameter manager is the class who knows how to apply a parameter change
 // for each specific object type.
@@ -118,13 +125,23 @@ class ParameterManager {
  public:
   ParameterManager() = default;
 
-  static void Init();
-  
   static const Parameter& parameter(uint8_t index);
   
   static uint8_t ControlChangeToParameterId(uint8_t cc);
   static uint8_t AddressToParameterId(uint8_t address);
   
+  // MIDI CC and NRPN are applied without loading the whole parameter
+  // definition from flash.
+  // Address in the part data of the parameter (and instance) controlled by a
+  // CC, or 0xff. The table is computed at compile time.
+  static uint8_t ControlChangeToAddress(uint8_t cc);
+  static uint8_t ScaleValue(uint8_t parameter_id, uint8_t value_7bits);
+  static uint8_t ClampValue(uint8_t parameter_id, uint8_t value);
+  static uint8_t IncrementValue(
+      uint8_t parameter_id,
+      uint8_t value,
+      int8_t increment);
+  
   static void SetValue(const Parameter& p, uint8_t part, uint8_t instance_index, uint8_t value, uint8_t user_initiated);
   static uint8_t GetValue(const Parameter& p, uint8_t part, uint8_t instance_index);
 
@@ -163,6 +180,9 @@ class ParameterManager {
   static Parameter cached_definition_;
   static uint8_t cached_index_;
   
+  // Reads the range of a parameter from its definition in flash.
+  static ParameterRange range(uint8_t parameter_id);
+  
   DISALLOW_COPY_AND_ASSIGN(ParameterManager);
 };
 
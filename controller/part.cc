@@ -15,7 +15,10 @@
 
 #include "controller/part.h"
 
+#include <string.h>
+
 #include "avrlib/op.h"
+#include "controller/clock_recovery.h"
 #include "controller/midi_dispatcher.h"
 #include "controller/parameter.h"
 #include "controller/resources.h"
@@ -27,6 +30,10 @@ using namespace avrlib;
 
 namespace ambika {
 
+static_assert(Patch::sizeBytes() == kNumPatchChunks * kPatchChunkSize);
+static constexpr uint16_t kAllPatchChunks = (1 << kNumPatchChunks) - 1;
+static constexpr uint16_t kPatchCommitFlag = 0x8000;
+
 static constexpr uint8_t midi_clock_tick_per_step[15] PROGMEM = {
   96, 72, 64, 48, 36, 32, 24, 16, 12, 8, 6, 4, 3, 2, 1
 };
@@ -150,10 +157,13 @@ void Part::Touch() {
   TouchLfos();
   flags_ = FLAG_HAS_CHANGE;
   
-  uint8_t* bytes = patch_.bytes();
-  for (uint8_t address = PRM_PART_VOLUME; address <= PRM_PART_PORTAMENTO_TIME; ++address) {
-    WriteToAllVoices(VOICECARD_DATA_PART, address - Patch::sizeBytes(), bytes[address]);
-  }
+  voicecard_tx.BroadcastRange(
+      voice_mask_,
+      VOICECARD_DATA_PART,
+      0,
+      data_.bytes(),
+      PRM_PART_PORTAMENTO_TIME - PRM_PART_VOLUME + 1);
+  TouchSequence();
   
   if (data_.polyphony_mode() != polyphony_mode_) {
     AllSoundOff();
@@ -163,22 +173,62 @@ void Part::Touch() {
 
 void Part::TouchPatch() {
   flags_ = FLAG_HAS_CHANGE;
-  // Send an "enter block write" command to all voicecards.
-  for (uint8_t i = 0; i < num_allocated_voices_; ++i) {
-    voicecard_tx.PrepareForBlockWrite(allocated_voices_[i]);
+  // The patch is sent in the background by StreamPatch(), while the
+  // voicecards keep playing with the previous patch.
+  patch_dirty_chunks_ = kAllPatchChunks | kPatchCommitFlag;
+}
+
+void Part::MergePatchChunk(uint8_t index, const uint8_t* data) {
+  uint8_t* chunk = patch_.bytes() + index * kPatchChunkSize;
+  if (memcmp(chunk, data, kPatchChunkSize)) {
+    memcpy(chunk, data, kPatchChunkSize);
+    patch_dirty_chunks_ |= 1 << index;
   }
-  // Wait for the voicecard to process the "enter block write" command.
-  ConstantDelay(5);
-  
-  // At this stage, all the voicecards are sitting in a tight SPI receive loop.
-  const uint8_t* patch_data = patch_.bytes();
-  for (uint8_t i = 0; i < num_allocated_voices_; ++i) {
-    voicecard_tx.WriteBlock(allocated_voices_[i], patch_data, Patch::sizeBytes());
+}
+
+void Part::TouchPatchDelta() {
+  flags_ = FLAG_HAS_CHANGE;
+  // Only the chunks marked by MergePatchChunk() are sent; when nothing
+  // changed, there is nothing to commit either.
+  if (patch_dirty_chunks_ & kAllPatchChunks) {
+    patch_dirty_chunks_ |= kPatchCommitFlag;
+  }
+}
+
+void Part::StreamPatch() {
+  if (!patch_dirty_chunks_) {
+    return;
+  }
+  if (!voice_mask_) {
+    patch_dirty_chunks_ = 0;
+    return;
+  }
+  // Never block the main loop: if the output buffers are busy, retry at the
+  // next control tick.
+  if (patch_dirty_chunks_ & kAllPatchChunks) {
+    if (voicecard_tx.writable(voice_mask_) <= kPatchChunkSize) {
+      return;
+    }
+    uint8_t index = 0;
+    uint16_t mask = 1;
+    while (!(patch_dirty_chunks_ & mask)) {
+      mask <<= 1;
+      ++index;
+    }
+    patch_dirty_chunks_ &= ~mask;
+    voicecard_tx.BroadcastPatchChunk(
+        voice_mask_,
+        index,
+        patch_.bytes() + index * kPatchChunkSize);
+  } else if (voicecard_tx.writable(voice_mask_)) {
+    patch_dirty_chunks_ = 0;
+    voicecard_tx.BroadcastCommitPatch(voice_mask_);
   }
 }
 
 void Part::Init() {
   ignore_note_off_messages_ = 0;
+  lfo_retrigger_pending_ = 0;
   pressed_keys_.Init();
   mono_allocator_.Init();
 }
@@ -211,16 +261,37 @@ void Part::InitSequence(InitializationMode mode) {
     // TODO this is really bad
     RandomizeRange(PRM_PART_ARP_DIRECTION, PartData::sequence_data_size);
   }
+  // The sequence data includes the polyphony mode: Touch() also resets the
+  // voice allocators if it has changed.
+  Touch();
 }
 
 void Part::RandomizeRange(uint8_t start, uint8_t size) {
+  // The new values are not sent one by one: the callers touch the whole
+  // range afterwards.
   for (uint8_t i = start; i < start + size; ++i) {
     uint8_t parameter_id = parameter_manager.AddressToParameterId(i);
     if (parameter_id != 0xff) {
       const Parameter& parameter = parameter_manager.parameter(parameter_id);
-      SetValue(i, parameter.RandomValue(), 0);
+      StoreValue(i, parameter.RandomValue());
     }
   }
+  flags_ |= FLAG_HAS_CHANGE;
+  TouchClock();
+  TouchLfos();
+  arp_direction_ = (data_.arp_direction() == ARPEGGIO_DIRECTION_DOWN ? -1 : 1);
+  StartArpeggio();
+}
+
+void Part::TouchSequence() {
+  // The voicecards keep their own copy of the two step sequences, so that a
+  // sequencer step only requires a compact "step" command.
+  voicecard_tx.BroadcastRange(
+      voice_mask_,
+      VOICECARD_DATA_SEQUENCE,
+      0,
+      data_.pure_sequence_data(),
+      kSequenceDataSize);
 }
 
 void Part::TouchClock() {
@@ -233,9 +304,11 @@ void Part::AssignVoices(uint8_t allocation) {
   
   uint8_t mask = 1;
   num_allocated_voices_ = 0;
+  voice_mask_ = 0;
   for (uint8_t i = 0; i < kNumVoices; ++i) {
     if (allocation & mask) {
       allocated_voices_[num_allocated_voices_++] = i;
+      voice_mask_ |= mask;
     }
     mask <<= 1;
   }
@@ -276,23 +349,31 @@ void Part::TouchLfos() {
 }
 
 void Part::SetValue(uint8_t address, uint8_t value, uint8_t user_initiated) {
-  uint8_t old_value = patch_.getData(address);
-  patch_.setData(address, value);
+  uint8_t old_value = GetValue(address);
+  StoreValue(address, value);
 
   flags_ |= FLAG_HAS_CHANGE;
   if (user_initiated) {
     midi_dispatcher.OnEdit(this, address, value);
-    flags_ |= FLAG_HAS_USER_CHANGE;
+    flags_ |= FLAG_HAS_USER_CHANGE | FLAG_NEEDS_SNAPSHOT;
   }
   
   // Some parameter changes need to be propagated to the voicecard.
   if (address < PRM_PART_VOLUME) {
-    // We have modified a patch parameter. Notify the voicecards.
-    WriteToAllVoices(VOICECARD_DATA_PATCH, address, value);
+    // We have modified a patch parameter. Notify the voicecards - unless the
+    // value is unchanged, since they all hold a copy of our patch.
+    if (value != old_value) {
+      WriteToAllVoices(VOICECARD_DATA_PATCH, address, value);
+    } else {
+      voicecard_tx.CountSuppressedWrites(num_allocated_voices_);
+    }
   } else if (address <= PRM_PART_PORTAMENTO_TIME) {
     // We have modified a part parameter a copy of which is needed by the
     // voicecard. Notify.
     WriteToAllVoices(VOICECARD_DATA_PART, address - Patch::sizeBytes(), value);
+  } else if (address >= PRM_PART_SEQUENCE_DATA &&
+             address < PRM_PART_SEQUENCE_DATA + kSequenceDataSize) {
+    WriteToAllVoices(VOICECARD_DATA_SEQUENCE, address - PRM_PART_SEQUENCE_DATA, value);
   }
   
   if (address == PRM_PART_POLYPHONY_MODE && old_value != value) {
@@ -313,6 +394,13 @@ void Part::SetValue(uint8_t address, uint8_t value, uint8_t user_initiated) {
   }
 }
 
+void Part::SetStepValue(uint8_t sequence, uint8_t step, uint8_t value) {
+  data_.set_step_value(sequence, step, value);
+  WriteToAllVoices(
+      VOICECARD_DATA_SEQUENCE,
+      byteAnd(step + (sequence << 4u), 0x1f),
+      value);
+}
 
 void Part::NoteOn(uint8_t note, uint8_t velocity) {
   if (!AcceptNote(note)) { 
@@ -409,12 +497,13 @@ void Part::ControlChange(uint8_t controller, uint8_t value) {
         if (parameter_id == 0xff) {
           return;
         }
-        const Parameter& parameter = parameter_manager.parameter(parameter_id);
         uint8_t new_value = GetValue(address);
         if (controller == midi::kDataEntryLsb) {
-          new_value = parameter.Clamp(value);
+          new_value = parameter_manager.ClampValue(parameter_id, value);
         } else {
-          new_value = parameter.Increment(new_value,
+          new_value = parameter_manager.IncrementValue(
+              parameter_id,
+              new_value,
               controller == midi::kDataIncrement ? 1 : -1);
         }
         if (system_settings.rx_nrpn()) {
@@ -425,31 +514,15 @@ void Part::ControlChange(uint8_t controller, uint8_t value) {
     default:
       {
         // Check if there is a mapping from this MIDI CC to a parameter.
-        uint8_t parameter_id = parameter_manager.ControlChangeToParameterId(controller);
-        if (parameter_id == 0xff) {
+        uint8_t address = parameter_manager.ControlChangeToAddress(controller);
+        if (address == 0xff) {
           return;
         }
-        const Parameter& parameter = parameter_manager.parameter(parameter_id);
-        // Some ranges of MIDI CC might point to the same parameter ID, for
-        // different instances of the same object (for example a LFO).
-        uint8_t instance_index = 0;
-        for (instance_index = 0;
-             instance_index < parameter.num_instances;
-             ++instance_index) {
-          if (parameter.midi_cc == controller) {
-            break;
-          }
-          controller -= parameter.stride;
-        }
-        uint8_t new_value = parameter.Scale(value);
+        uint8_t parameter_id = parameter_manager.ControlChangeToParameterId(
+            controller);
+        uint8_t new_value = parameter_manager.ScaleValue(parameter_id, value);
         if (system_settings.rx_cc()) {
-          if (parameter.level <= PARAMETER_LEVEL_PART) {
-            uint8_t address = parameter.offset + parameter.stride * instance_index;
-            SetValue(address, new_value, 0);
-          } else {
-            // Should not happen, but this is a graceful degradation...
-            parameter_manager.SetValue(parameter, 0, instance_index, value, 0 /* Not user initiated */);
-          }
+          SetValue(address, new_value, 0);
         }
       }
   }
@@ -508,6 +581,7 @@ void Part::Aftertouch(uint8_t velocity) {
 }
 
 void Part::AllSoundOff() {
+  voicecard_tx.CancelScheduled(voice_mask_);
   if (data_.polyphony_mode() == MONO) {
     mono_allocator_.Clear();
   } else {
@@ -523,6 +597,9 @@ void Part::AllNotesOff() {
   if (ignore_note_off_messages_) {
     return;
   }
+  // The notes computed ahead for the next tick would otherwise be sent after
+  // the releases below, and never be released.
+  voicecard_tx.CancelScheduled(voice_mask_);
   if (data_.polyphony_mode() == MONO) {
     mono_allocator_.Clear();
   } else {
@@ -574,10 +651,19 @@ void Part::Clock() {
   ++midi_clock_counter_;
   if (midi_clock_counter_ >= midi_clock_prescaler_) {
     midi_clock_counter_ = 0;
+    uint16_t pattern = ResourcesManager::Lookup<uint16_t, uint8_t>(
+        lut_res_arpeggiator_patterns, data_.arp_pattern());
+    uint8_t has_arpeggiator_note = (arp_pattern_mask_ & pattern) ? 255 : 0;
+    ClockVoices(has_arpeggiator_note);
     ClockSequencer();
-    ClockArpeggiator();
+    ClockArpeggiator(has_arpeggiator_note);
+  }
+}
+
+void Part::ClockLfos() {
+  if (lfo_retrigger_pending_) {
+    RetriggerLfos();
   }
-  
   for (uint8_t i = 0; i < kNumLfos; ++i) {
     if (patch_.env_lfo(i).rate < kNumSyncedLfoRates) {
       ++lfo_step_[i];
@@ -589,10 +675,9 @@ void Part::Clock() {
       uint16_t lfo_phase = increment * lfo_step_[i];
       // Force the phase of the LFO to match the MIDI clock.
       lfo_[i].set_phase(lfo_phase);
-      // Set the LFO increment so that, if the MIDI clock is regular, we will
-      // have reached the expected phase at the next clock tick.
-      lfo_[i].set_phase_increment(increment / midi_clock_tick_duration_);
-      midi_clock_tick_duration_ = 0;
+      // Set the LFO increment so that we will have reached the expected phase
+      // when the next clock tick is expected.
+      lfo_[i].set_phase_increment(clock_recovery.ScaleIncrement(increment));
     }
   }
 }
@@ -600,6 +685,7 @@ void Part::Clock() {
 void Part::Start() {
   memset(sequencer_step_, 0, kNumSequences);
   memset(lfo_step_, 0, kNumLfos);
+  lfo_retrigger_pending_ = 0;
   midi_clock_counter_ = midi_clock_prescaler_;
   previous_generated_note_ = 0xff;
   arp_pattern_mask_ = 0x1;
@@ -710,6 +796,9 @@ void Part::InternalNoteOff(uint8_t note) {
   
   uint8_t retrigger_lfos = 0;
   if (data_.polyphony_mode() == MONO) {
+    // A note computed ahead for the next tick would follow the release or
+    // retrigger sent now.
+    voicecard_tx.CancelScheduledNotes(voice_mask_);
     uint8_t top_note = mono_allocator_.most_recent_note().note;
     mono_allocator_.NoteOff(note);
     if (mono_allocator_.size() == 0) {
@@ -736,18 +825,18 @@ void Part::InternalNoteOff(uint8_t note) {
     if (data_.polyphony_mode() == UNISON_2X) {
       if (voice_index < poly_allocator_.size()) {
         voice_index <<= 1;
-        voicecard_tx.Release(allocated_voices_[voice_index]);
-        voicecard_tx.Release(allocated_voices_[GetNextVoice(voice_index)]);
+        ReleaseVoice(allocated_voices_[voice_index]);
+        ReleaseVoice(allocated_voices_[GetNextVoice(voice_index)]);
       }
     } else if (data_.polyphony_mode() == CHAIN) {
       if (voice_index < (poly_allocator_.size() / 2)) {
-        voicecard_tx.Release(allocated_voices_[voice_index]);
+        ReleaseVoice(allocated_voices_[voice_index]);
       } else {
         midi_dispatcher.ForwardNote(this, note, 0);
       }
     } else {
       if (voice_index < poly_allocator_.size()) {
-        voicecard_tx.Release(allocated_voices_[voice_index]);
+        ReleaseVoice(allocated_voices_[voice_index]);
       }
     }
   }
@@ -756,8 +845,14 @@ void Part::InternalNoteOff(uint8_t note) {
   }
 }
 
+void Part::ReleaseVoice(uint8_t voice_id) {
+  // The allocator has freed the voice: a note computed ahead for the next tick
+  // would keep it sounding.
+  voicecard_tx.CancelScheduledNotes(1 << voice_id);
+  voicecard_tx.Release(voice_id);
+}
+
 void Part::UpdateLfos(uint8_t refresh_cycle) {
-  ++midi_clock_tick_duration_;
   // No need to bother if there's no voicecard listening.
   if (num_allocated_voices_ == 0) {
     return;
@@ -769,9 +864,7 @@ void Part::UpdateLfos(uint8_t refresh_cycle) {
     // better for pseudo-audio rate modulation!
     if ((i == 0) || refresh_cycle) {
       if (new_lfo_value != lfo_previous_values_[i]) {
-        for (uint8_t j = 0; j < num_allocated_voices_; ++j) {
-          voicecard_tx.WriteLfo(allocated_voices_[j], i, new_lfo_value);
-        }
+        voicecard_tx.BroadcastLfo(voice_mask_, i, new_lfo_value);
       }
       lfo_previous_values_[i] = new_lfo_value;
     }
@@ -784,15 +877,20 @@ void Part::UpdateLfos(uint8_t refresh_cycle) {
         lfo_looped = lfo_step_[i] == 0;
       }
       if (lfo_looped) {
-        for (uint8_t j = 0; j < num_allocated_voices_; ++j) {
-          voicecard_tx.RetriggerEnvelope(allocated_voices_[j], i);
-        }
+        voicecard_tx.BroadcastRetriggerEnvelope(voice_mask_, i);
       }
     }
   }
 }
 
 void Part::RetriggerLfos() {
+  // The note will only be heard at the next tick: the LFOs are retriggered by
+  // ClockLfos() when the tick is due.
+  if (voicecard_tx.scheduling()) {
+    lfo_retrigger_pending_ = 1;
+    return;
+  }
+  lfo_retrigger_pending_ = 0;
   for (uint8_t i = 0; i < kNumLfos; ++i) {
     if (patch_.env_lfo(i).retrigger_mode == LFO_SYNC_MODE_SLAVE) {
       lfo_[i].set_phase(0);
@@ -801,15 +899,21 @@ void Part::RetriggerLfos() {
   }
 }
 
-void Part::ClockSequencer() {
-  // Update the value of the sequencer in the modulation matrix.
-  for (uint8_t i = 0; i < 2; ++i) {
-    uint8_t value = data_.step_value(i, sequencer_step_[i]);
-    if (data_.sequence_length(i)) {
-      WriteToAllVoices(VOICECARD_DATA_MODULATION, MOD_SRC_SEQ_1 + i, value);
-    }
+void Part::ClockVoices(uint8_t has_arpeggiator_note) {
+  // Tell the voicecards which step to read from their copy of the sequences,
+  // and whether the arpeggiator gate is open. This replaces the writes to
+  // MOD_SRC_SEQ_1, MOD_SRC_SEQ_2 and MOD_SRC_ARP_STEP.
+  uint8_t flags = has_arpeggiator_note ? STEP_FLAG_ARPEGGIATOR_GATE : 0;
+  if (data_.sequence_length(0)) {
+    flags |= STEP_FLAG_SEQUENCE_1;
   }
-  
+  if (data_.sequence_length(1)) {
+    flags |= STEP_FLAG_SEQUENCE_2;
+  }
+  voicecard_tx.BroadcastStep(voice_mask_, flags, sequencer_step_);
+}
+
+void Part::ClockSequencer() {
   // Trigger notes if there's a note sequence, and if a key is pressed on the
   // keyboard.
   if (data_.arp_sequencer_mode() == ARP_SEQUENCER_MODE_NOTE &&
@@ -849,15 +953,7 @@ void Part::ClockSequencer() {
   }
 }
 
-void Part::ClockArpeggiator() {
-  using rs = ResourcesManager;
-  uint16_t pattern = rs::Lookup<uint16_t, uint8_t>(lut_res_arpeggiator_patterns, data_.arp_pattern());
-  uint8_t has_arpeggiator_note = (arp_pattern_mask_ & pattern) ? 255 : 0;
-  // Update the gate value in the modulation matrix.
-  for (uint8_t i = 0; i < num_allocated_voices_; ++i) {
-    WriteToAllVoices(VOICECARD_DATA_MODULATION, MOD_SRC_ARP_STEP, has_arpeggiator_note);
-  }
-  
+void Part::ClockArpeggiator(uint8_t has_arpeggiator_note) {
   // Trigger notes only if the arp is on, and if keys are pressed.
   if (data_.arp_sequencer_mode() == ARP_SEQUENCER_MODE_ARPEGGIATOR) {
     if (pressed_keys_.size() && has_arpeggiator_note) {
@@ -956,9 +1052,7 @@ void Part::StepArpeggio() {
 }
 
 void Part::WriteToAllVoices(uint8_t data_type, uint8_t address, uint8_t value) {
-  for (uint8_t i = 0; i < num_allocated_voices_; ++i) {
-    voicecard_tx.WriteData(allocated_voices_[i], data_type, address, value);
-  }
+  voicecard_tx.BroadcastData(voice_mask_, data_type, address, value);
 }
 
 }  // namespace ambika
@@ -67,6 +67,8 @@ enum PolyphonyMode : uint8_t {
 enum PartFlags : uint8_t {
   FLAG_HAS_CHANGE = 1,
   FLAG_HAS_USER_CHANGE = 2,
+  // Set by user changes, cleared when the program is recorded in the history.
+  FLAG_NEEDS_SNAPSHOT = 4,
 };
 
 static const uint8_t kNumSequences = 3;
@@ -312,7 +314,8 @@ enum PartParameter : uint8_t {
   PRM_PART_SEQUENCE_LENGTH_1,
   PRM_PART_SEQUENCE_LENGTH_2,
   PRM_PART_SEQUENCE_LENGTH_3,
-  PRM_PART_POLYPHONY_MODE
+  PRM_PART_POLYPHONY_MODE,
+  PRM_PART_SEQUENCE_DATA
 };
 
 class Part {
@@ -337,6 +340,7 @@ class Part {
   void PolyModeOn();
   void Reset();
   void Clock();
+  void ClockLfos();
   void Start();
   void Stop();
 
@@ -348,8 +352,15 @@ class Part {
   
   void SetValue(uint8_t address, uint8_t value, uint8_t user_initiated);
   
+  // Edits a step of sequence 1 or 2 and mirrors it on the voicecards.
+  void SetStepValue(uint8_t sequence, uint8_t step, uint8_t value);
+  
+  // Addresses below PRM_PART_VOLUME are in the patch, the others in the part
+  // data.
   inline uint8_t GetValue(uint8_t address) const {
-    return patch_.getData(address);
+    return address < PRM_PART_VOLUME
+        ? patch_.getData(address)
+        : data_.getData(address - PRM_PART_VOLUME);
   }
 
   inline PartData& data() {
@@ -388,7 +399,14 @@ class Part {
 
   void Touch();
   void TouchPatch();
+  // Copies a chunk of a new patch image, and schedules it for transfer only
+  // if it differs from the current one. TouchPatchDelta() then sends the
+  // scheduled chunks.
+  void MergePatchChunk(uint8_t index, const uint8_t* data);
+  void TouchPatchDelta();
   void UpdateLfos(uint8_t refresh_cycle);
+  // Sends the next chunk of a pending patch transfer to the voicecards.
+  void StreamPatch();
   
   void AssignVoices(uint8_t allocation);
   inline uint8_t flags() const {
@@ -398,17 +416,27 @@ class Part {
   
 
  private:
+  inline void StoreValue(uint8_t address, uint8_t value) {
+    if (address < PRM_PART_VOLUME) {
+      patch_.setData(address, value);
+    } else {
+      data_.setData(address - PRM_PART_VOLUME, value);
+    }
+  }
+  
   void RandomizeRange(uint8_t start, uint8_t size);
   void InitializeAllocators();
   //void TouchVoiceAllocation();
   void TouchClock();
   void TouchLfos();
+  void TouchSequence();
   
   void RetriggerLfos();
   
   // Called on each "tick" of the arpeggiator and sequencer clock.
+  void ClockVoices(uint8_t has_arpeggiator_note);
   void ClockSequencer();
-  void ClockArpeggiator();
+  void ClockArpeggiator(uint8_t has_arpeggiator_note);
   
   // Called whenever a new arpeggiator note has to be triggered.
   void StartArpeggio();
@@ -424,6 +452,7 @@ class Part {
 
   void InternalNoteOn(uint8_t note, uint8_t velocity);
   void InternalNoteOff(uint8_t note);
+  void ReleaseVoice(uint8_t voice_id);
   
   uint8_t GetNextVoice(uint8_t voice_index) const;
 
@@ -432,15 +461,19 @@ class Part {
   
   uint8_t allocated_voices_[kNumVoices];
   uint8_t num_allocated_voices_;
+  uint8_t voice_mask_;
+  
+  // Chunks of the patch which have to be sent to the voicecards, and a flag
+  // set until the voicecards have been told to use the new patch.
+  uint16_t patch_dirty_chunks_;
   
   Lfo lfo_[kNumLfos];
   uint8_t lfo_step_[kNumLfos];
   uint8_t lfo_cycle_length_[kNumLfos];
   uint8_t lfo_previous_values_[kNumLfos];
   uint8_t lfo_refresh_cycle_;
-  // This variable is used to get an estimate of the MIDI clock tick duration
-  // expressed in 1/976 seconds (LFO refresh rate).
-  uint16_t midi_clock_tick_duration_;
+  // Set when a note computed ahead for the next tick retriggers the LFOs.
+  uint8_t lfo_retrigger_pending_;
   
   uint8_t midi_clock_prescaler_;
   uint8_t midi_clock_counter_;
@@ -0,0 +1,114 @@
+// Copyright 2011 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Load profiler.
+
+#include "controller/profiler.h"
+
+#include "controller/controller.h"
+
+namespace ambika {
+
+static const uint8_t kCyclesPerMicrosecond = 20;
+
+// Period of the TIMER1 and TIMER2 interrupts, in cycles.
+static const uint16_t kTimer1Period = 510 * 8;
+static const uint16_t kTimer2Period = 510;
+
+/* static */
+ProfilerStats Profiler::stats_[PROFILER_CHANNEL_LAST];
+
+/* static */
+uint16_t Profiler::start_[PROFILER_CHANNEL_LAST];
+
+/* static */
+uint8_t Profiler::timer2_samples_;
+
+/* static */
+void Profiler::Reset() {
+  for (uint8_t i = 0; i < PROFILER_CHANNEL_LAST; ++i) {
+    stats_[i].min = 0xffff;
+    stats_[i].max = 0;
+    stats_[i].total = 0;
+    stats_[i].count = 0;
+  }
+}
+
+/* static */
+uint32_t Profiler::ToMicroseconds(uint8_t channel, uint32_t duration) {
+  if (channel <= PROFILER_TIMER2_ISR) {
+    return duration / kCyclesPerMicrosecond;
+  } else {
+    // One tick of the 39kHz counter lasts 25.5us.
+    return duration * kSampleRateDen / (kSampleRateNum / 1000000);
+  }
+}
+
+/* static */
+uint32_t Profiler::min_duration(uint8_t channel) {
+  if (!stats_[channel].count) {
+    return 0;
+  }
+  return ToMicroseconds(channel, stats_[channel].min);
+}
+
+/* static */
+uint32_t Profiler::average_duration(uint8_t channel) {
+  if (!stats_[channel].count) {
+    return 0;
+  }
+  return ToMicroseconds(
+      channel,
+      stats_[channel].total / stats_[channel].count);
+}
+
+/* static */
+uint32_t Profiler::max_duration(uint8_t channel) {
+  return ToMicroseconds(channel, stats_[channel].max);
+}
+
+/* static */
+uint8_t Profiler::load(uint8_t channel) {
+  if (channel > PROFILER_TIMER2_ISR || !stats_[channel].count) {
+    return 0;
+  }
+  uint32_t cycles = stats_[channel].total / stats_[channel].count;
+  uint16_t period = channel == PROFILER_TIMER1_ISR
+      ? kTimer1Period
+      : kTimer2Period;
+  return cycles * 100 / period;
+}
+
+/* static */
+uint8_t Profiler::Report(uint8_t* data) {
+  uint8_t* p = data;
+  for (uint8_t i = 0; i < PROFILER_CHANNEL_LAST; ++i) {
+    uint32_t values[3] = {
+        min_duration(i), average_duration(i), max_duration(i) };
+    for (uint8_t j = 0; j < 3; ++j) {
+      uint16_t value = values[j] > 0xffff ? 0xffff : values[j];
+      *p++ = lowByte(value);
+      *p++ = highByte(value);
+    }
+  }
+  return p - data;
+}
+
+/* extern */
+Profiler profiler;
+
+}  // namespace ambika
@@ -0,0 +1,124 @@
+// Copyright 2011 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Load profiler. Keeps track of the min/average/max duration of the
+// interrupts and of the main loop tasks.
+
+#ifndef CONTROLLER_PROFILER_H_
+#define CONTROLLER_PROFILER_H_
+
+#include "avrlib/base.h"
+
+#include "controller/clock_recovery.h"
+
+namespace ambika {
+
+enum ProfilerChannel {
+  // Measured in CPU cycles. Interrupts nested in the TIMER1 interrupt are
+  // included in its duration.
+  PROFILER_TIMER1_ISR,
+  PROFILER_TIMER2_ISR,
+  // Measured in ticks of the 39kHz counter.
+  PROFILER_MIDI,
+  PROFILER_CLOCKS,
+  PROFILER_UI,
+  // Time during which the SD card holds the SPI bus.
+  PROFILER_STORAGE,
+  PROFILER_CHANNEL_LAST
+};
+
+// Only one TIMER2 interrupt out of 8 is measured, to keep the overhead low.
+static const uint8_t kProfilerTimer2SamplingRate = 8;
+
+struct ProfilerStats {
+  uint16_t min;
+  uint16_t max;
+  uint32_t total;
+  uint16_t count;
+};
+
+class Profiler {
+ public:
+  Profiler() { }
+  
+  static void Reset();
+  
+  static inline void Begin(uint8_t channel) {
+    start_[channel] = ClockRecovery::now();
+  }
+  
+  static inline void End(uint8_t channel) {
+    Record(channel, ClockRecovery::now() - start_[channel]);
+  }
+  
+  static inline void Record(uint8_t channel, uint16_t duration) {
+    ProfilerStats* s = &stats_[channel];
+    if (duration < s->min) {
+      s->min = duration;
+    }
+    if (duration > s->max) {
+      s->max = duration;
+    }
+    if (s->count == 0xffff) {
+      s->total >>= 1;
+      s->count >>= 1;
+    }
+    s->total += duration;
+    ++s->count;
+  }
+  
+  static inline uint8_t sample_timer2() {
+    return !(++timer2_samples_ & (kProfilerTimer2SamplingRate - 1));
+  }
+  
+  // Timers 1 and 2 run in phase correct mode: they count up to 255, then
+  // down to 0, where the overflow interrupt is triggered. Two readings of the
+  // counter, one count apart, tell in which direction it is going, and thus
+  // how many counts have elapsed since the overflow.
+  static inline uint16_t elapsed_counts(uint8_t first, uint8_t second) {
+    return second >= first ? second : 510 - second;
+  }
+  
+  static inline uint16_t count(uint8_t channel) {
+    return stats_[channel].count;
+  }
+  // Durations are converted to microseconds.
+  static uint32_t min_duration(uint8_t channel);
+  static uint32_t average_duration(uint8_t channel);
+  static uint32_t max_duration(uint8_t channel);
+  // Share of the CPU time spent in an interrupt, in %.
+  static uint8_t load(uint8_t channel);
+  
+  // Writes the min/average/max durations of all channels, in microseconds,
+  // as 16-bit little endian words. Returns the number of bytes written.
+  static uint8_t Report(uint8_t* data);
+  
+ private:
+  static uint32_t ToMicroseconds(uint8_t channel, uint32_t duration);
+   
+  static ProfilerStats stats_[PROFILER_CHANNEL_LAST];
+  static uint16_t start_[PROFILER_CHANNEL_LAST];
+  static uint8_t timer2_samples_;
+  
+  DISALLOW_COPY_AND_ASSIGN(Profiler);
+};
+
+extern Profiler profiler;
+
+}  // namespace ambika
+
+#endif  // CONTROLLER_PROFILER_H_
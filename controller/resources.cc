@@ -68,6 +68,7 @@ static const char str_res_pattern[] PROGMEM = "pattern";
 static const char str_res_channel[] PROGMEM = "channel";
 static const char str_res_part[] PROGMEM = "part";
 static const char str_res_bpm[] PROGMEM = "bpm";
+static const char str_res_fine[] PROGMEM = "fine";
 static const char str_res_ltch[] PROGMEM = "ltch";
 static const char str_res_latch[] PROGMEM = "latch";
 static const char str_res_low[] PROGMEM = "low";
@@ -425,6 +426,7 @@ const char* const string_table[] PROGMEM = {
   str_res_channel,
   str_res_part,
   str_res_bpm,
+  str_res_fine,
   str_res_ltch,
   str_res_latch,
   str_res_low,
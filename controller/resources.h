@@ -128,341 +128,342 @@ extern const uint8_t wav_res_lfo_waveforms[] PROGMEM;
 #define STR_RES_CHANNEL 41  // channel
 #define STR_RES_PART 42  // part
 #define STR_RES_BPM 43  // bpm
-#define STR_RES_LTCH 44  // ltch
-#define STR_RES_LATCH 45  // latch
-#define STR_RES_LOW 46  // low
-#define STR_RES_HIGH 47  // high
-#define STR_RES_GRID 48  // grid
-#define STR_RES_SEQ1_LEN 49  // seq1 len
-#define STR_RES_SEQ2_LEN 50  // seq2 len
-#define STR_RES_PATT_LEN 51  // patt len
-#define STR_RES_LEN1 52  // len1
-#define STR_RES_LEN2 53  // len2
-#define STR_RES_LENP 54  // lenp
-#define STR_RES_GROOVE 55  // groove
-#define STR_RES_MIDI 56  // midi
-#define STR_RES_SNAP 57  // snap
-#define STR_RES_HELP 58  // help
-#define STR_RES_AUTO_BACKUP 59  // auto backup
-#define STR_RES_LEDS 60  // leds
-#define STR_RES_CARD_LEDS 61  // card leds
-#define STR_RES_SWAP_COLORS 62  // swap colors
-#define STR_RES_INPT_FILTER 63  // inpt filter
-#define STR_RES_OUTP_MODE 64  // outp mode
-#define STR_RES_EXT 65  // ext
-#define STR_RES_OMNI 66  // omni
-#define STR_RES_AMNT 67  // amnt
-#define STR_RES_SRCE 68  // srce
-#define STR_RES_OCT 69  // oct
-#define STR_RES_SPRD 70  // sprd
-#define STR_RES_A_SQ 71  // a/sq
-#define STR_RES_OCTV 72  // octv
-#define STR_RES_OFF 73  // off
-#define STR_RES_ON 74  // on
-#define STR_RES_NONE 75  // none
-#define STR_RES_SAW 76  // saw
-#define STR_RES_SQUARE 77  // square
-#define STR_RES_TRIANGLE 78  // triangle
-#define STR_RES_SINE 79  // sine
-#define STR_RES_ZSAW 80  // zsaw
-#define STR_RES_LPZSAW 81  // lpzsaw
-#define STR_RES_PKZSAW 82  // pkzsaw
-#define STR_RES_BPZSAW 83  // bpzsaw
-#define STR_RES_HPZSAW 84  // hpzsaw
-#define STR_RES_LPZPULSE 85  // lpzpulse
-#define STR_RES_PKZPULSE 86  // pkzpulse
-#define STR_RES_BPZPULSE 87  // bpzpulse
-#define STR_RES_HPZPULSE 88  // hpzpulse
-#define STR_RES_ZTRIANGLE 89  // ztriangle
-#define STR_RES_PAD 90  // pad
-#define STR_RES_FM 91  // fm
-#define STR_RES_8BITS 92  // 8bits
-#define STR_RES_PWM 93  // pwm
-#define STR_RES_NOISE 94  // noise
-#define STR_RES_VOWEL 95  // vowel
-#define STR_RES_POLYSAW 96  // polysaw
-#define STR_RES_POLYPWM 97  // polypwm
-#define STR_RES_POLYCSW 98  // polycsw
-#define STR_RES_MALE 99  // male
-#define STR_RES_FEMALE 100  // female
-#define STR_RES_CHOIR 101  // choir
-#define STR_RES_TAMPURA 102  // tampura
-#define STR_RES_BOWED 103  // bowed
-#define STR_RES_CELLO 104  // cello
-#define STR_RES_VIBES 105  // vibes
-#define STR_RES_SLAP 106  // slap
-#define STR_RES_EPIANO 107  // epiano
-#define STR_RES_ORGAN 108  // organ
-#define STR_RES_WAVES 109  // waves
-#define STR_RES_DIGITAL 110  // digital
-#define STR_RES_DRONE_1 111  // drone 1
-#define STR_RES_DRONE_2 112  // drone 2
-#define STR_RES_METALLIC 113  // metallic
-#define STR_RES_BELL 114  // bell
-#define STR_RES_WAVQUENCE 115  // wavquence
-#define STR_RES_TRI 116  // tri
-#define STR_RES_SQR 117  // sqr
-#define STR_RES_S_H 118  // s&h
-#define STR_RES_RAMP 119  // ramp
-#define STR_RES__SINE 120  // sine
-#define STR_RES_HRM2 121  // hrm2
-#define STR_RES_HRM3 122  // hrm3
-#define STR_RES_HRM5 123  // hrm5
-#define STR_RES_GRG1 124  // grg1
-#define STR_RES_GRG2 125  // grg2
-#define STR_RES_BAT1 126  // bat1
-#define STR_RES_BAT2 127  // bat2
-#define STR_RES_SPK1 128  // spk1
-#define STR_RES_SPK2 129  // spk2
-#define STR_RES_LSAW 130  // lsaw
-#define STR_RES_LSQR 131  // lsqr
-#define STR_RES_RSAW 132  // rsaw
-#define STR_RES_RSQR 133  // rsqr
-#define STR_RES_STP1 134  // stp1
-#define STR_RES_STP2 135  // stp2
-#define STR_RES___OFF 136  // off
-#define STR_RES_SYNC 137  // sync
-#define STR_RES_RINGMOD 138  // ringmod
-#define STR_RES_XOR 139  // xor
-#define STR_RES_FOLD 140  // fold
-#define STR_RES_BITS 141  // bits
-#define STR_RES_SQU1 142  // squ1
-#define STR_RES_TRI1 143  // tri1
-#define STR_RES_PUL1 144  // pul1
-#define STR_RES_SQU2 145  // squ2
-#define STR_RES_TRI2 146  // tri2
-#define STR_RES_PUL2 147  // pul2
-#define STR_RES_CLICK 148  // click
-#define STR_RES_GLITCH 149  // glitch
-#define STR_RES_BLOW 150  // blow
-#define STR_RES_METAL 151  // metal
-#define STR_RES_POP 152  // pop
-#define STR_RES_ENV1 153  // env1
-#define STR_RES_ENV2 154  // env2
-#define STR_RES_ENV3 155  // env3
-#define STR_RES_LFO1 156  // lfo1
-#define STR_RES_LFO2 157  // lfo2
-#define STR_RES_LFO3 158  // lfo3
-#define STR_RES_LFO4 159  // lfo4
-#define STR_RES_MOD1 160  // mod1
-#define STR_RES_MOD2 161  // mod2
-#define STR_RES_MOD3 162  // mod3
-#define STR_RES_MOD4 163  // mod4
-#define STR_RES_SEQ1 164  // seq1
-#define STR_RES_SEQ2 165  // seq2
-#define STR_RES_ARP 166  // arp
-#define STR_RES_VELO 167  // velo
-#define STR_RES_AFTR 168  // aftr
-#define STR_RES_BEND 169  // bend
-#define STR_RES_MWHL 170  // mwhl
-#define STR_RES_WHL2 171  // whl2
-#define STR_RES_PDAL 172  // pdal
-#define STR_RES_NOTE 173  // note
-#define STR_RES_GATE 174  // gate
-#define STR_RES_NOIS 175  // nois
-#define STR_RES_RAND 176  // rand
-#define STR_RES_E256 177  // =256
-#define STR_RES_E128 178  // =128
-#define STR_RES_E64 179  // =64
-#define STR_RES_E32 180  // =32
-#define STR_RES_E16 181  // =16
-#define STR_RES_E8 182  // =8
-#define STR_RES_E4 183  // =4
-#define STR_RES_PRM1 184  // prm1
-#define STR_RES_PRM2 185  // prm2
-#define STR_RES_OSC1 186  // osc1
-#define STR_RES_OSC2 187  // osc2
-#define STR_RES_31S2 188  // 1+2
-#define STR_RES_VIBR 189  // vibr
-#define STR_RES_MIX 190  // mix
-#define STR_RES_XMOD 191  // xmod
-#define STR_RES__NOIS 192  // nois
-#define STR_RES_SUB 193  // sub
-#define STR_RES_FUZZ 194  // fuzz
-#define STR_RES_CRSH 195  // crsh
-#define STR_RES_FREQ 196  // freq
-#define STR_RES_RESO 197  // reso
-#define STR_RES_ATTK 198  // attk
-#define STR_RES_DECA 199  // deca
-#define STR_RES_RELE 200  // rele
-#define STR_RES__LFO4 201  // lfo4
-#define STR_RES_VCA 202  // vca
-#define STR_RES_ENV_1 203  // env 1
-#define STR_RES_ENV_2 204  // env 2
-#define STR_RES_ENV_3 205  // env 3
-#define STR_RES_LFO_1 206  // lfo 1
-#define STR_RES_LFO_2 207  // lfo 2
-#define STR_RES_LFO_3 208  // lfo 3
-#define STR_RES_LFO_4 209  // lfo 4
-#define STR_RES_MOD__1 210  // mod. 1
-#define STR_RES_MOD__2 211  // mod. 2
-#define STR_RES_MOD__3 212  // mod. 3
-#define STR_RES_MOD__4 213  // mod. 4
-#define STR_RES_SEQ__1 214  // seq. 1
-#define STR_RES_SEQ__2 215  // seq. 2
-#define STR_RES__ARP 216  // arp
-#define STR_RES__VELO 217  // velo
-#define STR_RES_AFTTCH 218  // afttch
-#define STR_RES_BENDER 219  // bender
-#define STR_RES_MWHEEL 220  // mwheel
-#define STR_RES_WHEEL2 221  // wheel2
-#define STR_RES_PEDAL 222  // pedal
-#define STR_RES__NOTE 223  // note
-#define STR_RES__GATE 224  // gate
-#define STR_RES__NOISE 225  // noise
-#define STR_RES_RANDOM 226  // random
-#define STR_RES_E_256 227  // = 256
-#define STR_RES_E_32 228  // = 32
-#define STR_RES_E_16 229  // = 16
-#define STR_RES_E_8 230  // = 8
-#define STR_RES_E_4 231  // = 4
-#define STR_RES_PARAM_1 232  // param 1
-#define STR_RES_PARAM_2 233  // param 2
-#define STR_RES_OSC_1 234  // osc 1
-#define STR_RES_OSC_2 235  // osc 2
-#define STR_RES_OSC_1S2 236  // osc 1+2
-#define STR_RES_VIBRATO 237  // vibrato
-#define STR_RES__MIX 238  // mix
-#define STR_RES__XMOD 239  // xmod
-#define STR_RES___NOISE 240  // noise
-#define STR_RES_SUBOSC 241  // subosc
-#define STR_RES__FUZZ 242  // fuzz
-#define STR_RES_CRUSH 243  // crush
-#define STR_RES_FREQUENCY 244  // frequency
-#define STR_RES__RESO 245  // reso
-#define STR_RES__ATTACK 246  // attack
-#define STR_RES__DECAY 247  // decay
-#define STR_RES__RELEASE 248  // release
-#define STR_RES__LFO_4 249  // lfo 4
-#define STR_RES__VCA 250  // vca
-#define STR_RES_LP 251  // lp
-#define STR_RES_BP 252  // bp
-#define STR_RES_HP 253  // hp
-#define STR_RES_FREE 254  // free
-#define STR_RES_ENVTLFO 255  // env~lfo
-#define STR_RES_LFOTENV 256  // lfo~env
-#define STR_RES_STEP_SEQ 257  // step seq
-#define STR_RES_ARPEGGIO 258  // arpeggio
-#define STR_RES__PATTERN 259  // pattern
-#define STR_RES__OFF 260  // off
-#define STR_RES_ADD 261  // add
-#define STR_RES_PROD 262  // prod
-#define STR_RES_ATTN 263  // attn
-#define STR_RES_MAX 264  // max
-#define STR_RES_MIN 265  // min
-#define STR_RES__XOR 266  // xor
-#define STR_RES_GE 267  // >=
-#define STR_RES_LE 268  // <=
-#define STR_RES_QTZ 269  // qtz
-#define STR_RES_LAG 270  // lag
-#define STR_RES_MONO 271  // mono
-#define STR_RES_POLY 272  // poly
-#define STR_RES_2X_UNISON 273  // 2x unison
-#define STR_RES_CYCLIC 274  // cyclic
-#define STR_RES_CHAIN 275  // chain
-#define STR_RES_UP 276  // up
-#define STR_RES_DOWN 277  // down
-#define STR_RES_UP_DOWN 278  // up&down
-#define STR_RES_PLAYED 279  // played
-#define STR_RES__RANDOM 280  // random
-#define STR_RES_CHORD 281  // chord
-#define STR_RES_1_1 282  // 1/1
-#define STR_RES_3_4 283  // 3/4
-#define STR_RES_2_3 284  // 2/3
-#define STR_RES_1_2 285  // 1/2
-#define STR_RES_3_8 286  // 3/8
-#define STR_RES_1_3 287  // 1/3
-#define STR_RES_1_4 288  // 1/4
-#define STR_RES_1_6 289  // 1/6
-#define STR_RES_1_8 290  // 1/8
-#define STR_RES_1_12 291  // 1/12
-#define STR_RES_1_16 292  // 1/16
-#define STR_RES_1_24 293  // 1/24
-#define STR_RES_1_32 294  // 1/32
-#define STR_RES_1_48 295  // 1/48
-#define STR_RES_1_96 296  // 1/96
-#define STR_RES_THRU 297  // thru
-#define STR_RES_SEQUENCER 298  // sequencer
-#define STR_RES_CONTROLLR 299  // controllr
-#define STR_RES__CHAIN 300  // chain
-#define STR_RES_FULL 301  // full
-#define STR_RES_____ 302  // ....
-#define STR_RES____S 303  // ...s
-#define STR_RES___P_ 304  // ..p.
-#define STR_RES___PS 305  // ..ps
-#define STR_RES__N__ 306  // .n..
-#define STR_RES__N_S 307  // .n.s
-#define STR_RES__NP_ 308  // .np.
-#define STR_RES__NPS 309  // .nps
-#define STR_RES_C___ 310  // c...
-#define STR_RES_C__S 311  // c..s
-#define STR_RES_C_P_ 312  // c.p.
-#define STR_RES_C_PS 313  // c.ps
-#define STR_RES_CN__ 314  // cn..
-#define STR_RES_CN_S 315  // cn.s
-#define STR_RES_CNP_ 316  // cnp.
-#define STR_RES_CNPS 317  // cnps
-#define STR_RES_SWING 318  // swing
-#define STR_RES_SHUFFLE 319  // shuffle
-#define STR_RES_PUSH 320  // push
-#define STR_RES__LAG 321  // lag
-#define STR_RES_HUMAN 322  // human
-#define STR_RES_MONKEY 323  // monkey
-#define STR_RES_OSCILLATOR_1 324  // oscillator 1
-#define STR_RES_OSCILLATOR_2 325  // oscillator 2
-#define STR_RES_MIXER 326  // mixer
-#define STR_RES_LFO 327  // lfo
-#define STR_RES_FILTER_1 328  // filter 1
-#define STR_RES_FILTER_2 329  // filter 2
-#define STR_RES_ENVELOPE 330  // envelope
-#define STR_RES_ARPEGGIATOR 331  // arpeggiator
-#define STR_RES_MULTI 332  // multi
-#define STR_RES_CLOCK 333  // clock
-#define STR_RES_PERFORMANCE 334  // performance
-#define STR_RES_SYSTEM 335  // system
-#define STR_RES_PT_X_PATCH 336  // pt X patch
-#define STR_RES_PT_X_SEQUENCE 337  // pt X sequence
-#define STR_RES_PT_X_PROGRAM 338  // pt X program
-#define STR_RES_RANDOMIZE 339  // randomize
-#define STR_RES_INIT 340  // init
-#define STR_RES_PATCH 341  // PATCH
-#define STR_RES_SEQUENCE 342  // SEQUENCE
-#define STR_RES_PROGRAM 343  // PROGRAM
-#define STR_RES__MULTI 344  // MULTI
-#define STR_RES____ 345  // ___
-#define STR_RES_EQUAL 346  // equal
-#define STR_RES_JUST 347  // just
-#define STR_RES_PYTHAGOREAN 348  // pythagorean
-#define STR_RES_1_4_EB 349  // 1/4 eb
-#define STR_RES_1_4_E 350  // 1/4 e
-#define STR_RES_1_4_EA 351  // 1/4 ea
-#define STR_RES_BHAIRAV 352  // bhairav
-#define STR_RES_GUNAKRI 353  // gunakri
-#define STR_RES_MARWA 354  // marwa
-#define STR_RES_SHREE 355  // shree
-#define STR_RES_PURVI 356  // purvi
-#define STR_RES_BILAWAL 357  // bilawal
-#define STR_RES_YAMAN 358  // yaman
-#define STR_RES_KAFI 359  // kafi
-#define STR_RES_BHIMPALASREE 360  // bhimpalasree
-#define STR_RES_DARBARI 361  // darbari
-#define STR_RES_BAGESHREE 362  // bageshree
-#define STR_RES_RAGESHREE 363  // rageshree
-#define STR_RES_KHAMAJ 364  // khamaj
-#define STR_RES_MIMAL 365  // mi'mal
-#define STR_RES_PARAMESHWARI 366  // parameshwari
-#define STR_RES_RANGESHWARI 367  // rangeshwari
-#define STR_RES_GANGESHWARI 368  // gangeshwari
-#define STR_RES_KAMESHWARI 369  // kameshwari
-#define STR_RES_PA__KAFI 370  // pa. kafi
-#define STR_RES_NATBHAIRAV 371  // natbhairav
-#define STR_RES_M_KAUNS 372  // m.kauns
-#define STR_RES_BAIRAGI 373  // bairagi
-#define STR_RES_B_TODI 374  // b.todi
-#define STR_RES_CHANDRADEEP 375  // chandradeep
-#define STR_RES_KAUSHIK_TODI 376  // kaushik todi
-#define STR_RES_JOGESHWARI 377  // jogeshwari
-#define STR_RES_RASIA 378  // rasia
+#define STR_RES_FINE 44  // fine
+#define STR_RES_LTCH 45  // ltch
+#define STR_RES_LATCH 46  // latch
+#define STR_RES_LOW 47  // low
+#define STR_RES_HIGH 48  // high
+#define STR_RES_GRID 49  // grid
+#define STR_RES_SEQ1_LEN 50  // seq1 len
+#define STR_RES_SEQ2_LEN 51  // seq2 len
+#define STR_RES_PATT_LEN 52  // patt len
+#define STR_RES_LEN1 53  // len1
+#define STR_RES_LEN2 54  // len2
+#define STR_RES_LENP 55  // lenp
+#define STR_RES_GROOVE 56  // groove
+#define STR_RES_MIDI 57  // midi
+#define STR_RES_SNAP 58  // snap
+#define STR_RES_HELP 59  // help
+#define STR_RES_AUTO_BACKUP 60  // auto backup
+#define STR_RES_LEDS 61  // leds
+#define STR_RES_CARD_LEDS 62  // card leds
+#define STR_RES_SWAP_COLORS 63  // swap colors
+#define STR_RES_INPT_FILTER 64  // inpt filter
+#define STR_RES_OUTP_MODE 65  // outp mode
+#define STR_RES_EXT 66  // ext
+#define STR_RES_OMNI 67  // omni
+#define STR_RES_AMNT 68  // amnt
+#define STR_RES_SRCE 69  // srce
+#define STR_RES_OCT 70  // oct
+#define STR_RES_SPRD 71  // sprd
+#define STR_RES_A_SQ 72  // a/sq
+#define STR_RES_OCTV 73  // octv
+#define STR_RES_OFF 74  // off
+#define STR_RES_ON 75  // on
+#define STR_RES_NONE 76  // none
+#define STR_RES_SAW 77  // saw
+#define STR_RES_SQUARE 78  // square
+#define STR_RES_TRIANGLE 79  // triangle
+#define STR_RES_SINE 80  // sine
+#define STR_RES_ZSAW 81  // zsaw
+#define STR_RES_LPZSAW 82  // lpzsaw
+#define STR_RES_PKZSAW 83  // pkzsaw
+#define STR_RES_BPZSAW 84  // bpzsaw
+#define STR_RES_HPZSAW 85  // hpzsaw
+#define STR_RES_LPZPULSE 86  // lpzpulse
+#define STR_RES_PKZPULSE 87  // pkzpulse
+#define STR_RES_BPZPULSE 88  // bpzpulse
+#define STR_RES_HPZPULSE 89  // hpzpulse
+#define STR_RES_ZTRIANGLE 90  // ztriangle
+#define STR_RES_PAD 91  // pad
+#define STR_RES_FM 92  // fm
+#define STR_RES_8BITS 93  // 8bits
+#define STR_RES_PWM 94  // pwm
+#define STR_RES_NOISE 95  // noise
+#define STR_RES_VOWEL 96  // vowel
+#define STR_RES_POLYSAW 97  // polysaw
+#define STR_RES_POLYPWM 98  // polypwm
+#define STR_RES_POLYCSW 99  // polycsw
+#define STR_RES_MALE 100  // male
+#define STR_RES_FEMALE 101  // female
+#define STR_RES_CHOIR 102  // choir
+#define STR_RES_TAMPURA 103  // tampura
+#define STR_RES_BOWED 104  // bowed
+#define STR_RES_CELLO 105  // cello
+#define STR_RES_VIBES 106  // vibes
+#define STR_RES_SLAP 107  // slap
+#define STR_RES_EPIANO 108  // epiano
+#define STR_RES_ORGAN 109  // organ
+#define STR_RES_WAVES 110  // waves
+#define STR_RES_DIGITAL 111  // digital
+#define STR_RES_DRONE_1 112  // drone 1
+#define STR_RES_DRONE_2 113  // drone 2
+#define STR_RES_METALLIC 114  // metallic
+#define STR_RES_BELL 115  // bell
+#define STR_RES_WAVQUENCE 116  // wavquence
+#define STR_RES_TRI 117  // tri
+#define STR_RES_SQR 118  // sqr
+#define STR_RES_S_H 119  // s&h
+#define STR_RES_RAMP 120  // ramp
+#define STR_RES__SINE 121  // sine
+#define STR_RES_HRM2 122  // hrm2
+#define STR_RES_HRM3 123  // hrm3
+#define STR_RES_HRM5 124  // hrm5
+#define STR_RES_GRG1 125  // grg1
+#define STR_RES_GRG2 126  // grg2
+#define STR_RES_BAT1 127  // bat1
+#define STR_RES_BAT2 128  // bat2
+#define STR_RES_SPK1 129  // spk1
+#define STR_RES_SPK2 130  // spk2
+#define STR_RES_LSAW 131  // lsaw
+#define STR_RES_LSQR 132  // lsqr
+#define STR_RES_RSAW 133  // rsaw
+#define STR_RES_RSQR 134  // rsqr
+#define STR_RES_STP1 135  // stp1
+#define STR_RES_STP2 136  // stp2
+#define STR_RES___OFF 137  // off
+#define STR_RES_SYNC 138  // sync
+#define STR_RES_RINGMOD 139  // ringmod
+#define STR_RES_XOR 140  // xor
+#define STR_RES_FOLD 141  // fold
+#define STR_RES_BITS 142  // bits
+#define STR_RES_SQU1 143  // squ1
+#define STR_RES_TRI1 144  // tri1
+#define STR_RES_PUL1 145  // pul1
+#define STR_RES_SQU2 146  // squ2
+#define STR_RES_TRI2 147  // tri2
+#define STR_RES_PUL2 148  // pul2
+#define STR_RES_CLICK 149  // click
+#define STR_RES_GLITCH 150  // glitch
+#define STR_RES_BLOW 151  // blow
+#define STR_RES_METAL 152  // metal
+#define STR_RES_POP 153  // pop
+#define STR_RES_ENV1 154  // env1
+#define STR_RES_ENV2 155  // env2
+#define STR_RES_ENV3 156  // env3
+#define STR_RES_LFO1 157  // lfo1
+#define STR_RES_LFO2 158  // lfo2
+#define STR_RES_LFO3 159  // lfo3
+#define STR_RES_LFO4 160  // lfo4
+#define STR_RES_MOD1 161  // mod1
+#define STR_RES_MOD2 162  // mod2
+#define STR_RES_MOD3 163  // mod3
+#define STR_RES_MOD4 164  // mod4
+#define STR_RES_SEQ1 165  // seq1
+#define STR_RES_SEQ2 166  // seq2
+#define STR_RES_ARP 167  // arp
+#define STR_RES_VELO 168  // velo
+#define STR_RES_AFTR 169  // aftr
+#define STR_RES_BEND 170  // bend
+#define STR_RES_MWHL 171  // mwhl
+#define STR_RES_WHL2 172  // whl2
+#define STR_RES_PDAL 173  // pdal
+#define STR_RES_NOTE 174  // note
+#define STR_RES_GATE 175  // gate
+#define STR_RES_NOIS 176  // nois
+#define STR_RES_RAND 177  // rand
+#define STR_RES_E256 178  // =256
+#define STR_RES_E128 179  // =128
+#define STR_RES_E64 180  // =64
+#define STR_RES_E32 181  // =32
+#define STR_RES_E16 182  // =16
+#define STR_RES_E8 183  // =8
+#define STR_RES_E4 184  // =4
+#define STR_RES_PRM1 185  // prm1
+#define STR_RES_PRM2 186  // prm2
+#define STR_RES_OSC1 187  // osc1
+#define STR_RES_OSC2 188  // osc2
+#define STR_RES_31S2 189  // 1+2
+#define STR_RES_VIBR 190  // vibr
+#define STR_RES_MIX 191  // mix
+#define STR_RES_XMOD 192  // xmod
+#define STR_RES__NOIS 193  // nois
+#define STR_RES_SUB 194  // sub
+#define STR_RES_FUZZ 195  // fuzz
+#define STR_RES_CRSH 196  // crsh
+#define STR_RES_FREQ 197  // freq
+#define STR_RES_RESO 198  // reso
+#define STR_RES_ATTK 199  // attk
+#define STR_RES_DECA 200  // deca
+#define STR_RES_RELE 201  // rele
+#define STR_RES__LFO4 202  // lfo4
+#define STR_RES_VCA 203  // vca
+#define STR_RES_ENV_1 204  // env 1
+#define STR_RES_ENV_2 205  // env 2
+#define STR_RES_ENV_3 206  // env 3
+#define STR_RES_LFO_1 207  // lfo 1
+#define STR_RES_LFO_2 208  // lfo 2
+#define STR_RES_LFO_3 209  // lfo 3
+#define STR_RES_LFO_4 210  // lfo 4
+#define STR_RES_MOD__1 211  // mod. 1
+#define STR_RES_MOD__2 212  // mod. 2
+#define STR_RES_MOD__3 213  // mod. 3
+#define STR_RES_MOD__4 214  // mod. 4
+#define STR_RES_SEQ__1 215  // seq. 1
+#define STR_RES_SEQ__2 216  // seq. 2
+#define STR_RES__ARP 217  // arp
+#define STR_RES__VELO 218  // velo
+#define STR_RES_AFTTCH 219  // afttch
+#define STR_RES_BENDER 220  // bender
+#define STR_RES_MWHEEL 221  // mwheel
+#define STR_RES_WHEEL2 222  // wheel2
+#define STR_RES_PEDAL 223  // pedal
+#define STR_RES__NOTE 224  // note
+#define STR_RES__GATE 225  // gate
+#define STR_RES__NOISE 226  // noise
+#define STR_RES_RANDOM 227  // random
+#define STR_RES_E_256 228  // = 256
+#define STR_RES_E_32 229  // = 32
+#define STR_RES_E_16 230  // = 16
+#define STR_RES_E_8 231  // = 8
+#define STR_RES_E_4 232  // = 4
+#define STR_RES_PARAM_1 233  // param 1
+#define STR_RES_PARAM_2 234  // param 2
+#define STR_RES_OSC_1 235  // osc 1
+#define STR_RES_OSC_2 236  // osc 2
+#define STR_RES_OSC_1S2 237  // osc 1+2
+#define STR_RES_VIBRATO 238  // vibrato
+#define STR_RES__MIX 239  // mix
+#define STR_RES__XMOD 240  // xmod
+#define STR_RES___NOISE 241  // noise
+#define STR_RES_SUBOSC 242  // subosc
+#define STR_RES__FUZZ 243  // fuzz
+#define STR_RES_CRUSH 244  // crush
+#define STR_RES_FREQUENCY 245  // frequency
+#define STR_RES__RESO 246  // reso
+#define STR_RES__ATTACK 247  // attack
+#define STR_RES__DECAY 248  // decay
+#define STR_RES__RELEASE 249  // release
+#define STR_RES__LFO_4 250  // lfo 4
+#define STR_RES__VCA 251  // vca
+#define STR_RES_LP 252  // lp
+#define STR_RES_BP 253  // bp
+#define STR_RES_HP 254  // hp
+#define STR_RES_FREE 255  // free
+#define STR_RES_ENVTLFO 256  // env~lfo
+#define STR_RES_LFOTENV 257  // lfo~env
+#define STR_RES_STEP_SEQ 258  // step seq
+#define STR_RES_ARPEGGIO 259  // arpeggio
+#define STR_RES__PATTERN 260  // pattern
+#define STR_RES__OFF 261  // off
+#define STR_RES_ADD 262  // add
+#define STR_RES_PROD 263  // prod
+#define STR_RES_ATTN 264  // attn
+#define STR_RES_MAX 265  // max
+#define STR_RES_MIN 266  // min
+#define STR_RES__XOR 267  // xor
+#define STR_RES_GE 268  // >=
+#define STR_RES_LE 269  // <=
+#define STR_RES_QTZ 270  // qtz
+#define STR_RES_LAG 271  // lag
+#define STR_RES_MONO 272  // mono
+#define STR_RES_POLY 273  // poly
+#define STR_RES_2X_UNISON 274  // 2x unison
+#define STR_RES_CYCLIC 275  // cyclic
+#define STR_RES_CHAIN 276  // chain
+#define STR_RES_UP 277  // up
+#define STR_RES_DOWN 278  // down
+#define STR_RES_UP_DOWN 279  // up&down
+#define STR_RES_PLAYED 280  // played
+#define STR_RES__RANDOM 281  // random
+#define STR_RES_CHORD 282  // chord
+#define STR_RES_1_1 283  // 1/1
+#define STR_RES_3_4 284  // 3/4
+#define STR_RES_2_3 285  // 2/3
+#define STR_RES_1_2 286  // 1/2
+#define STR_RES_3_8 287  // 3/8
+#define STR_RES_1_3 288  // 1/3
+#define STR_RES_1_4 289  // 1/4
+#define STR_RES_1_6 290  // 1/6
+#define STR_RES_1_8 291  // 1/8
+#define STR_RES_1_12 292  // 1/12
+#define STR_RES_1_16 293  // 1/16
+#define STR_RES_1_24 294  // 1/24
+#define STR_RES_1_32 295  // 1/32
+#define STR_RES_1_48 296  // 1/48
+#define STR_RES_1_96 297  // 1/96
+#define STR_RES_THRU 298  // thru
+#define STR_RES_SEQUENCER 299  // sequencer
+#define STR_RES_CONTROLLR 300  // controllr
+#define STR_RES__CHAIN 301  // chain
+#define STR_RES_FULL 302  // full
+#define STR_RES_____ 303  // ....
+#define STR_RES____S 304  // ...s
+#define STR_RES___P_ 305  // ..p.
+#define STR_RES___PS 306  // ..ps
+#define STR_RES__N__ 307  // .n..
+#define STR_RES__N_S 308  // .n.s
+#define STR_RES__NP_ 309  // .np.
+#define STR_RES__NPS 310  // .nps
+#define STR_RES_C___ 311  // c...
+#define STR_RES_C__S 312  // c..s
+#define STR_RES_C_P_ 313  // c.p.
+#define STR_RES_C_PS 314  // c.ps
+#define STR_RES_CN__ 315  // cn..
+#define STR_RES_CN_S 316  // cn.s
+#define STR_RES_CNP_ 317  // cnp.
+#define STR_RES_CNPS 318  // cnps
+#define STR_RES_SWING 319  // swing
+#define STR_RES_SHUFFLE 320  // shuffle
+#define STR_RES_PUSH 321  // push
+#define STR_RES__LAG 322  // lag
+#define STR_RES_HUMAN 323  // human
+#define STR_RES_MONKEY 324  // monkey
+#define STR_RES_OSCILLATOR_1 325  // oscillator 1
+#define STR_RES_OSCILLATOR_2 326  // oscillator 2
+#define STR_RES_MIXER 327  // mixer
+#define STR_RES_LFO 328  // lfo
+#define STR_RES_FILTER_1 329  // filter 1
+#define STR_RES_FILTER_2 330  // filter 2
+#define STR_RES_ENVELOPE 331  // envelope
+#define STR_RES_ARPEGGIATOR 332  // arpeggiator
+#define STR_RES_MULTI 333  // multi
+#define STR_RES_CLOCK 334  // clock
+#define STR_RES_PERFORMANCE 335  // performance
+#define STR_RES_SYSTEM 336  // system
+#define STR_RES_PT_X_PATCH 337  // pt X patch
+#define STR_RES_PT_X_SEQUENCE 338  // pt X sequence
+#define STR_RES_PT_X_PROGRAM 339  // pt X program
+#define STR_RES_RANDOMIZE 340  // randomize
+#define STR_RES_INIT 341  // init
+#define STR_RES_PATCH 342  // PATCH
+#define STR_RES_SEQUENCE 343  // SEQUENCE
+#define STR_RES_PROGRAM 344  // PROGRAM
+#define STR_RES__MULTI 345  // MULTI
+#define STR_RES____ 346  // ___
+#define STR_RES_EQUAL 347  // equal
+#define STR_RES_JUST 348  // just
+#define STR_RES_PYTHAGOREAN 349  // pythagorean
+#define STR_RES_1_4_EB 350  // 1/4 eb
+#define STR_RES_1_4_E 351  // 1/4 e
+#define STR_RES_1_4_EA 352  // 1/4 ea
+#define STR_RES_BHAIRAV 353  // bhairav
+#define STR_RES_GUNAKRI 354  // gunakri
+#define STR_RES_MARWA 355  // marwa
+#define STR_RES_SHREE 356  // shree
+#define STR_RES_PURVI 357  // purvi
+#define STR_RES_BILAWAL 358  // bilawal
+#define STR_RES_YAMAN 359  // yaman
+#define STR_RES_KAFI 360  // kafi
+#define STR_RES_BHIMPALASREE 361  // bhimpalasree
+#define STR_RES_DARBARI 362  // darbari
+#define STR_RES_BAGESHREE 363  // bageshree
+#define STR_RES_RAGESHREE 364  // rageshree
+#define STR_RES_KHAMAJ 365  // khamaj
+#define STR_RES_MIMAL 366  // mi'mal
+#define STR_RES_PARAMESHWARI 367  // parameshwari
+#define STR_RES_RANGESHWARI 368  // rangeshwari
+#define STR_RES_GANGESHWARI 369  // gangeshwari
+#define STR_RES_KAMESHWARI 370  // kameshwari
+#define STR_RES_PA__KAFI 371  // pa. kafi
+#define STR_RES_NATBHAIRAV 372  // natbhairav
+#define STR_RES_M_KAUNS 373  // m.kauns
+#define STR_RES_BAIRAGI 374  // bairagi
+#define STR_RES_B_TODI 375  // b.todi
+#define STR_RES_CHANDRADEEP 376  // chandradeep
+#define STR_RES_KAUSHIK_TODI 377  // kaushik todi
+#define STR_RES_JOGESHWARI 378  // jogeshwari
+#define STR_RES_RASIA 379  // rasia
 #define LUT_RES_LFO_INCREMENTS 0
 #define LUT_RES_LFO_INCREMENTS_SIZE 128
 #define LUT_RES_SCALE_JUST 1
@@ -64,6 +64,7 @@ pattern
 channel
 part
 bpm
+fine
 ltch
 latch
 low
@@ -24,10 +24,15 @@
 #include "avrlib/bitops.h"
 #include "avrlib/op.h"
 #include "avrlib/string.h"
+#include "avrlib/time.h"
 
+#include "common/protocol.h"
+
+#include "controller/buffered_file.h"
 #include "controller/display.h"
 #include "controller/midi_dispatcher.h"
 #include "controller/multi.h"
+#include "controller/profiler.h"
 #include "controller/system_settings.h"
 #include "controller/ui.h"
 
@@ -38,6 +43,36 @@ static constexpr uint32_t kRiffTag = FourCC('R', 'I', 'F', 'F');
 static constexpr uint32_t kFormatTag = FourCC('M', 'B', 'K', 'S');
 static constexpr uint32_t kNameTag = FourCC('n', 'a', 'm', 'e');
 static constexpr uint32_t kObjectTag = FourCC('o', 'b', 'j', ' ');
+static constexpr uint32_t kPackedBankTag = FourCC('A', 'M', 'P', 'K');
+
+// A packed bank holds all the slots of a bank in a single file:
+// - this header,
+// - the names of all the slots,
+// - the records of all the slots, each with the same RIFF image as the
+// corresponding file, or zeros for an empty slot.
+struct PackedBankHeader {
+  uint32_t tag;
+  uint16_t record_size;
+  uint8_t object;
+  uint8_t num_slots;
+  uint8_t padding[8];
+};
+
+// The history journal of an object type is a ring of kHistoryDepth records per
+// part. Each record is this header followed by the RIFF image of the object.
+// The header is written last, so an interrupted write leaves an invalid record
+// rather than a corrupted one.
+struct HistoryRecordHeader {
+  // Object + 1, so that a zero-filled record is never valid.
+  uint8_t object;
+  uint8_t part;
+  uint8_t version;
+  uint8_t checksum;
+};
+
+static constexpr uint16_t kPackedBankNamesOffset = sizeof(PackedBankHeader);
+static constexpr uint16_t kPackedBankRecordsOffset = kPackedBankNamesOffset +
+    kNumBankSlots * kPackedBankNameSize;
 
 using namespace avrlib;
 
@@ -50,9 +85,42 @@ static constexpr uint8_t sysex_header[] PROGMEM = {
 /* static */
 Filesystem Storage::fs_;
 
+/* static */
+uint8_t Storage::filesystem_ready_;
+
 /* static */
 File Storage::file_;
 
+/* static */
+File Storage::bank_file_;
+
+/* static */
+File Storage::set_file_;
+
+/* static */
+uint16_t Storage::performance_set_[kPerformanceSetSize];
+
+/* static */
+void (*Storage::yield_fn_)();
+
+/* static */
+uint8_t Storage::yielding_;
+
+/* static */
+uint32_t Storage::last_yield_time_;
+
+/* static */
+char Storage::name_cache_[kNameCacheSize][kPackedBankNameSize];
+
+/* static */
+uint8_t Storage::name_cache_base_ = 0xff;
+
+/* static */
+uint8_t Storage::name_cache_bank_;
+
+/* static */
+uint8_t Storage::name_cache_object_;
+
 /* static */
 uint8_t* Storage::buffer_;
 
@@ -71,6 +139,36 @@ uint16_t Storage::sysex_rx_expected_size_;
 /* static */
 uint8_t Storage::sysex_rx_command_[2];
 
+/* static */
+uint8_t Storage::sysex_rx_packed_msbs_;
+
+/* static */
+uint8_t Storage::sysex_rx_received_checksum_;
+
+/* static */
+StorageLocation Storage::sysex_rx_location_;
+
+/* static */
+uint8_t Storage::sysex_rx_record_flags_;
+
+/* static */
+char Storage::sysex_rx_name_[kPackedBankNameSize];
+
+/* static */
+StorageLocation Storage::sysex_tx_location_;
+
+/* static */
+uint8_t Storage::sysex_tx_bank_dump_;
+
+/* static */
+uint8_t Storage::sysex_tx_group_[7];
+
+/* static */
+uint8_t Storage::sysex_tx_group_size_;
+
+/* static */
+uint8_t Storage::sysex_tx_checksum_;
+
 /* static */
 char Storage::tmp_buffer_[64];
 
@@ -80,6 +178,8 @@ uint8_t Storage::version_[kNumVoices * 3 + 1];
 /* static */
 void Storage::Init() {
   buffer_ = fs_.buffer();
+  BufferedFile::Init(&file_);
+  memset(performance_set_, 0xff, sizeof(performance_set_));
 }
 
 /* static */
@@ -225,29 +325,33 @@ uint8_t Storage::has_user_changes(const StorageLocation& location) {
 
 /* static */
 void Storage::Snapshot(const StorageLocation& location) {
-  StorageLocation l = location;
   uint8_t version = version_[location.index()];
-  l.slot = version;
-  Save(STORAGE_HISTORY, l);
+  WriteHistoryRecord(location, version);
+  version_[location.index()] = version + 1;
   
-  // Create a gap in the version number sequence to prevent forwarding.
-  ++version;
-  l.slot = version;
-  char* forward_version_name = GetFileName(STORAGE_HISTORY, l);
-  {
-    scoped_resource<SdCardSession> session;
-    InvalidatePendingSysExTransfer();
-    fs_.Unlink(forward_version_name);
+  if (location.object == STORAGE_OBJECT_MULTI) {
+    multi.ClearFlag(FLAG_NEEDS_SNAPSHOT);
+  } else if (location.object == STORAGE_OBJECT_PROGRAM) {
+    multi.part(location.part).ClearFlag(FLAG_NEEDS_SNAPSHOT);
+  }
+}
+
+/* static */
+void Storage::SnapshotEdits(uint8_t part) {
+  if (!filesystem_ready_ ||
+      !(multi.part(part).flags() & FLAG_NEEDS_SNAPSHOT)) {
+    return;
   }
-  version_[location.index()] = version;
+  StorageLocation location = {
+    STORAGE_OBJECT_PROGRAM, part, 0, 0, 0, nullptr
+  };
+  Snapshot(location);
 }
 
 /* static */
 FilesystemStatus Storage::PreviousVersion(const StorageLocation& location) {
-  StorageLocation l = location;
   uint8_t version = version_[location.index()] - 1;
-  l.slot = version;
-  FilesystemStatus status = Load(STORAGE_HISTORY, l, 1);
+  FilesystemStatus status = LoadHistoryRecord(location, version);
   if (status == FS_OK) {
     version_[location.index()] = version;
   }
@@ -256,16 +360,123 @@ FilesystemStatus Storage::PreviousVersion(const StorageLocation& location) {
 
 /* static */
 FilesystemStatus Storage::NextVersion(const StorageLocation& location) {
-  StorageLocation l = location;
   uint8_t version = version_[location.index()] + 1;
-  l.slot = version;
-  FilesystemStatus status = Load(STORAGE_HISTORY, l, 1);
+  FilesystemStatus status = LoadHistoryRecord(location, version);
   if (status == FS_OK) {
     version_[location.index()] = version;
   }
   return status;
 }
 
+/* static */
+FilesystemStatus Storage::OpenHistory(const StorageLocation& location) {
+  char* name = GetFileName(STORAGE_HISTORY, location);
+  FilesystemStatus s = file_.Open(
+      name,
+      FA_READ | FA_WRITE | FA_OPEN_ALWAYS,
+      kFsInitTimeout);
+  if (s == FS_PATH_NOT_FOUND) {
+    fs_.Mkdirs(name);
+    s = file_.Open(name, FA_READ | FA_WRITE | FA_OPEN_ALWAYS, kFsInitTimeout);
+  }
+  return s;
+}
+
+/* static */
+uint32_t Storage::history_record_offset(
+    const StorageLocation& location,
+    uint8_t version) {
+  uint8_t record = version & (kHistoryDepth - 1);
+  if (location.object != STORAGE_OBJECT_MULTI) {
+    record += location.part * kHistoryDepth;
+  }
+  return static_cast<uint32_t>(record) *
+      (sizeof(HistoryRecordHeader) + packed_record_size(location));
+}
+
+/* static */
+void Storage::WriteHistoryRecord(const StorageLocation& location, uint8_t version) {
+  scoped_resource<SdCardSession> session;
+  
+  file_.Close();
+  InvalidatePendingSysExTransfer();
+  if (OpenHistory(location) != FS_OK) {
+    return;
+  }
+  
+  uint16_t written;
+  uint32_t offset = history_record_offset(location, version);
+  HistoryRecordHeader header = { 0, 0, 0, 0 };
+  
+  // Clear the record of the next version, so that it is not possible to move
+  // forward from this version - the next version belonged to another branch of
+  // the history.
+  file_.Seek(history_record_offset(location, version + 1));
+  file_.Write(&header, sizeof(header), &written);
+  
+  file_.Seek(offset + sizeof(header));
+  BufferedFile::Rewind();
+  BufferedFile::ResetChecksum();
+  WriteRIFF(location);
+  
+  header.object = location.object + 1;
+  header.part = location.part;
+  header.version = version;
+  header.checksum = BufferedFile::checksum();
+  file_.Seek(offset);
+  file_.Write(&header, sizeof(header), &written);
+  file_.Close();
+}
+
+/* static */
+FilesystemStatus Storage::LoadHistoryRecord(
+    const StorageLocation& location,
+    uint8_t version) {
+  {
+    scoped_resource<SdCardSession> session;
+    
+    file_.Close();
+    InvalidatePendingSysExTransfer();
+    FilesystemStatus s = file_.Open(
+        GetFileName(STORAGE_HISTORY, location),
+        FA_READ | FA_OPEN_EXISTING,
+        kFsInitTimeout);
+    if (s != FS_OK) {
+      return s;
+    }
+    
+    uint32_t start = history_record_offset(location, version);
+    uint16_t size = packed_record_size(location);
+    HistoryRecordHeader header;
+    BufferedFile::Seek(start);
+    BufferedFile::Read(&header, sizeof(header));
+    
+    // The record must hold this version of this object - not an older version
+    // which was in the same place in the ring.
+    s = FS_BAD_FILE_FORMAT;
+    if (header.object == location.object + 1 &&
+        header.part == location.part &&
+        header.version == version) {
+      uint8_t block[16];
+      BufferedFile::ResetChecksum();
+      for (uint16_t i = 0; i < size; i += sizeof(block)) {
+        BufferedFile::Read(block, size - i < sizeof(block) ? size - i : sizeof(block));
+      }
+      if (BufferedFile::checksum() == header.checksum) {
+        start += sizeof(header);
+        BufferedFile::Seek(start);
+        s = ReadRIFF(location, 1, start + size);
+      }
+    }
+    file_.Close();
+    if (s != FS_OK) {
+      return s;
+    }
+  }
+  ForEachObject(location, TouchObject);
+  return FS_OK;
+}
+
 /* static */
 void Storage::ForEachObject(const StorageLocation& location, ObjectFn object_fn) {
   StorageLocation destination = location;
@@ -300,6 +511,13 @@ void Storage::ForEachObject(const StorageLocation& location, ObjectFn object_fn)
 
 /* static */
 void Storage::ReadObject(const StorageLocation& location) {
+  if (location.object == STORAGE_OBJECT_PATCH) {
+    Part& part = multi.part(location.part);
+    for (uint8_t i = 0; i < kNumPatchChunks; ++i) {
+      part.MergePatchChunk(i, buffer_ + i * kPatchChunkSize);
+    }
+    return;
+  }
   uint8_t* data = mutable_object_data(location);
   uint8_t size = object_size(location);
   if (size) {
@@ -313,7 +531,8 @@ void Storage::TouchObject(const StorageLocation& location) {
   // object is freshly loaded and has received no user changes.
   switch (location.object) {
     case STORAGE_OBJECT_PATCH:
-      multi.part(location.part).TouchPatch();
+      // Only the chunks which differ from the previous patch are sent.
+      multi.part(location.part).TouchPatchDelta();
       break;
 
     case STORAGE_OBJECT_PART:
@@ -340,11 +559,255 @@ void Storage::SysExSendObject(const StorageLocation& l) {
   SysExSendRaw(l.object + 1, l.alias, object_data(l), object_size(l), false);
 }
 
+/* static */
+void Storage::SysExSendPackedObject(const StorageLocation& l) {
+  SysExSendPackedRaw(0x21 + l.object, l.alias, object_data(l), object_size(l));
+}
+
+/* static */
+void Storage::SysExSendPackedRaw(
+    uint8_t command,
+    uint8_t argument,
+    const uint8_t* data,
+    uint8_t size) {
+  SysExBeginPacked(command, argument);
+  SysExPack(data, size);
+  SysExEndPacked();
+}
+
+/* static */
+void Storage::SysExBeginPacked(uint8_t command, uint8_t argument) {
+  midi_dispatcher.Flush();
+  for (uint8_t i = 0; i < sizeof(sysex_header); ++i) {
+    midi_dispatcher.SendBlocking(pgm_read_byte(sysex_header + i));
+  }
+  midi_dispatcher.SendBlocking(command);
+  midi_dispatcher.SendBlocking(argument);
+  sysex_tx_checksum_ = 0;
+  sysex_tx_group_size_ = 0;
+}
+
+/* static */
+void Storage::SysExPack(const uint8_t* data, uint8_t size) {
+  // The data is sent by groups of 7 bytes. Each group is preceded by a byte
+  // holding their most significant bits.
+  while (size--) {
+    uint8_t byte = *data++;
+    sysex_tx_checksum_ += byte;
+    sysex_tx_group_[sysex_tx_group_size_++] = byte;
+    if (sysex_tx_group_size_ == sizeof(sysex_tx_group_)) {
+      SysExSendPackedGroup();
+    }
+  }
+}
+
+/* static */
+void Storage::SysExSendPackedGroup() {
+  uint8_t msbs = 0;
+  for (uint8_t i = 0; i < sysex_tx_group_size_; ++i) {
+    if (sysex_tx_group_[i] & 0x80) {
+      msbs |= 1 << i;
+    }
+  }
+  midi_dispatcher.SendBlocking(msbs);
+  for (uint8_t i = 0; i < sysex_tx_group_size_; ++i) {
+    midi_dispatcher.SendBlocking(sysex_tx_group_[i] & 0x7f);
+  }
+  sysex_tx_group_size_ = 0;
+}
+
+/* static */
+void Storage::SysExEndPacked() {
+  // The checksum is packed as the last byte of the data.
+  uint8_t checksum = sysex_tx_checksum_;
+  SysExPack(&checksum, 1);
+  if (sysex_tx_group_size_) {
+    SysExSendPackedGroup();
+  }
+
+  // End of SysEx block.
+  midi_dispatcher.SendBlocking(0xf7);
+  midi_dispatcher.Flush();
+}
+
+/* static */
+uint8_t Storage::OpenBankRecord(const StorageLocation& location) {
+  if (OpenPackedBank(location, FA_READ | FA_OPEN_EXISTING) == FS_OK) {
+    file_.Seek(packed_record_offset(location));
+    BufferedFile::Rewind();
+    return 1;
+  }
+  FilesystemStatus s = file_.Open(
+      GetFileName(STORAGE_BANK, location),
+      FA_READ | FA_OPEN_EXISTING,
+      kFsInitTimeout);
+  BufferedFile::Rewind();
+  return s == FS_OK ? 0 : 0xff;
+}
+
+/* static */
+void Storage::SysExSendBankRecord() {
+  StorageLocation& l = sysex_tx_location_;
+  LongWord id;
+  
+  // Find the next slot holding an object.
+  for (; l.slot < kNumBankSlots; ++l.slot) {
+    scoped_resource<SdCardSession> session;
+    file_.Close();
+    if (OpenBankRecord(l) != 0xff) {
+      if (BufferedFile::Read(id.bytes, 4) == 4 && id.value == kRiffTag) {
+        break;
+      }
+      file_.Close();
+    }
+  }
+  
+  if (l.slot == kNumBankSlots) {
+    sysex_tx_bank_dump_ = 0;
+    SysExSendPackedRaw(0x4f, l.bank, nullptr, 0);
+    return;
+  }
+  
+  // The record is read from the card and sent by small blocks, so the bus is
+  // regularly released to the voicecards.
+  SysExBeginPacked(0x41 + l.object, l.slot);
+  SysExPack(&l.bank, 1);
+  SysExPack(id.bytes, 4);
+  uint16_t remaining = packed_record_size(l) - 4;
+  while (remaining) {
+    uint8_t block[16];
+    uint8_t size = remaining < sizeof(block) ? remaining : sizeof(block);
+    memset(block, 0, size);
+    {
+      scoped_resource<SdCardSession> session;
+      BufferedFile::Read(block, size);
+    }
+    SysExPack(block, size);
+    remaining -= size;
+  }
+  SysExEndPacked();
+  {
+    scoped_resource<SdCardSession> session;
+    file_.Close();
+  }
+}
+
+/* static */
+void Storage::SysExReceiveRecordByte(uint16_t index, uint8_t byte) {
+  StorageLocation& l = sysex_rx_location_;
+  if (index == 0) {
+    // The first byte is the bank. The record is written to a scratch file as
+    // it is received, and only replaces the slot once its checksum has been
+    // verified.
+    scoped_resource<SdCardSession> session;
+    l.bank = byte;
+    file_.Close();
+    sysex_rx_record_flags_ = 0xff;
+    if (byte < kNumBanks) {
+      strcpy_P(tmp_buffer_, PSTR("/SYSEX.TMP"));
+      if (file_.Open(
+              tmp_buffer_,
+              FA_WRITE | FA_CREATE_ALWAYS,
+              kFsInitTimeout) == FS_OK) {
+        sysex_rx_record_flags_ = 0;
+      }
+    }
+    BufferedFile::Rewind();
+    return;
+  }
+  if (sysex_rx_record_flags_ == 0xff) {
+    return;
+  }
+  // The card is only accessed when a whole block has been received.
+  if (byteAnd(lowByte(index), kBufferedFileBlockSize - 1) == 0) {
+    scoped_resource<SdCardSession> session;
+    BufferedFile::Write(&byte, 1);
+  } else {
+    BufferedFile::Write(&byte, 1);
+  }
+  // Keep a copy of the name for the name table and index.
+  uint16_t name_offset = index - 1 - 20;
+  if (name_offset < kPackedBankNameSize) {
+    sysex_rx_name_[name_offset] = byte;
+  }
+}
+
+/* static */
+uint8_t Storage::SysExAcceptBankRecord() {
+  StorageLocation& l = sysex_rx_location_;
+  if (sysex_rx_record_flags_ == 0xff) {
+    return 0;
+  }
+  scoped_resource<SdCardSession> session;
+  BufferedFile::Flush();
+  file_.Close();
+  sysex_rx_record_flags_ = 0xff;
+  
+  char scratch_name[12];
+  strcpy_P(scratch_name, PSTR("/SYSEX.TMP"));
+  l.name = sysex_rx_name_;
+  uint8_t success = 0;
+  if (OpenPackedBank(l, FA_READ | FA_WRITE | FA_OPEN_EXISTING) == FS_OK) {
+    // Copy the record to its place in the packed bank.
+    if (bank_file_.Open(
+            scratch_name,
+            FA_READ | FA_OPEN_EXISTING,
+            kFsInitTimeout) == FS_OK) {
+      uint16_t written;
+      file_.Seek(packed_record_offset(l));
+      CopyData(&bank_file_, &file_, packed_record_size(l));
+      file_.Seek(packed_name_offset(l));
+      file_.Write(l.name, kPackedBankNameSize, &written);
+      bank_file_.Close();
+      success = 1;
+    }
+    file_.Close();
+  } else {
+    // The scratch file becomes the record file of the slot. The previous
+    // record is kept aside until then.
+    char* name = GetFileName(STORAGE_BANK, l);
+    char* backup_name = tmp_buffer_ + 32;
+    strcpy(backup_name, name);
+    backup_name[strlen(backup_name) - 3] = '~';
+    fs_.Unlink(backup_name);
+    fs_.Rename(name, backup_name);
+    FilesystemStatus s = fs_.Rename(scratch_name, name);
+    if (s == FS_PATH_NOT_FOUND) {
+      fs_.Mkdirs(name);
+      s = fs_.Rename(scratch_name, name);
+    }
+    if (s == FS_OK) {
+      if (!system_settings.data().autobackup()) {
+        fs_.Unlink(backup_name);
+      }
+      UpdateNameIndex(l);
+      success = 1;
+    } else {
+      fs_.Rename(backup_name, name);
+    }
+  }
+  if (success) {
+    UpdateNameCache(l);
+  }
+  l.name = nullptr;
+  if (!success) {
+    return 0;
+  }
+  
+  // The copy of this program in the performance set is now out of date.
+  uint8_t index = performance_set_index(l);
+  if (index != 0xff) {
+    performance_set_[index] = 0xffff;
+  }
+  return 1;
+}
+
+
 /* static */
 void Storage::SysExSendRaw(uint8_t command, uint8_t argument, const uint8_t* data, uint8_t size, bool send_address) {
   midi_dispatcher.Flush();
   for (uint8_t i = 0; i < sizeof(sysex_header); ++i) {
-    midi_dispatcher.SendBlocking(pgm_read_byte(sysex_header[i]));
+    midi_dispatcher.SendBlocking(pgm_read_byte(sysex_header + i));
   }
   midi_dispatcher.SendBlocking(command);
   midi_dispatcher.SendBlocking(argument);
@@ -381,108 +844,197 @@ void Storage::RIFFWriteObject(const StorageLocation& location) {
   const uint8_t* data = object_data(location);
   uint8_t size = object_size(location);
   
+  Yield();
+  
   LongWord w;
-  uint16_t written;
 
   // Write the RIFF header.
   w.value = kObjectTag;
-  file_.Write(w.bytes, 4, &written);
+  BufferedFile::Write(w.bytes, 4);
   w.value = size + 4;
-  file_.Write(w.bytes, 4, &written);
+  BufferedFile::Write(w.bytes, 4);
   // Write the position words.
   w.value = 0;
   w.bytes[0] = location.object + 1;
   w.bytes[1] = location.alias;
-  file_.Write(w.bytes, 4, &written);
+  BufferedFile::Write(w.bytes, 4);
   
   // Write the data.
-  file_.Write(data, size, &written);
+  BufferedFile::Write(data, size);
 }
 
 /* static */
-FilesystemStatus Storage::Load(StorageDir type, const StorageLocation& location, uint8_t load_contents) {
-  {
-    scoped_resource<SdCardSession> session;
+FilesystemStatus Storage::ReadRIFF(
+    const StorageLocation& location,
+    uint8_t load_contents,
+    uint32_t end) {
+  LongWord id;
+  LongWord size;
+
+  BufferedFile::Read(id.bytes, 4);
+  if (id.value != kRiffTag) {
+    return FS_BAD_FILE_FORMAT;
+  }
+  // Skip the size.
+  BufferedFile::Read(size.bytes, 4);
+  BufferedFile::Read(id.bytes, 4);
+  if (id.value != kFormatTag) {
+    return FS_BAD_FILE_FORMAT;
+  }
 
-    FilesystemStatus s;
-    char* name = GetFileName(type, location);
-  
-    file_.Close();
-    InvalidatePendingSysExTransfer();
-  
-    s = file_.Open(name, FA_READ | FA_OPEN_EXISTING, kFsInitTimeout);
-    if (s != FS_OK) {
-      return s;
-    }
-  
-    LongWord id;
-    LongWord size;
-    uint16_t read;
-  
-    file_.Read(id.bytes, 4, &read);
-    if (id.value != kRiffTag) {
-      file_.Close();
-      return FS_BAD_FILE_FORMAT;
-    }
-    // Skip the size.
-    file_.Read(size.bytes, 4, &read);
-    file_.Read(id.bytes, 4, &read);
-    if (id.value != kFormatTag) {
-      file_.Close();
-      return FS_BAD_FILE_FORMAT;
-    }
+  while (!BufferedFile::eof() && BufferedFile::tell() < end) {
+    Yield();
+    BufferedFile::Read(id.bytes, 4);
+    BufferedFile::Read(size.bytes, 4);
+    uint8_t skip_data = 1;
   
-    while (!file_.eof()) {
-      file_.Read(id.bytes, 4, &read);
-      file_.Read(size.bytes, 4, &read);
-      uint8_t skip_data = 1;
-    
-      if (id.value == kObjectTag && load_contents) {
-        file_.Read(id.bytes, 4, &read);
-        StorageLocation destination {
-            .object = static_cast<StorageObject>(id.bytes[0] - 1),
-            .part = U8(id.bytes[1] == 0 ? location.part : (id.bytes[1] - 1)),
-            .alias = 0,
-            .bank = 0,
-            .slot = 0,
-            .name = nullptr
-        };
-
-        uint8_t expected_size = object_size(destination);
-        if (expected_size == size.value - 4) {
+    if (id.value == kObjectTag && load_contents) {
+      BufferedFile::Read(id.bytes, 4);
+      StorageLocation destination {
+          .object = static_cast<StorageObject>(id.bytes[0] - 1),
+          .part = U8(id.bytes[1] == 0 ? location.part : (id.bytes[1] - 1)),
+          .alias = 0,
+          .bank = 0,
+          .slot = 0,
+          .name = nullptr
+      };
+
+      uint8_t expected_size = object_size(destination);
+      if (expected_size == size.value - 4) {
+        if (destination.object == STORAGE_OBJECT_PATCH) {
+          // Compare the new patch with the current one chunk by chunk, so
+          // that only the differences are sent to the voicecards.
+          Part& part = multi.part(destination.part);
+          uint8_t chunk[kPatchChunkSize];
+          for (uint8_t i = 0; i < kNumPatchChunks; ++i) {
+            BufferedFile::Read(chunk, kPatchChunkSize);
+            part.MergePatchChunk(i, chunk);
+          }
+        } else {
           uint8_t* data = mutable_object_data(destination);
-          file_.Read(data, expected_size, &read);
-          skip_data = 0;
+          BufferedFile::Read(data, expected_size);
         }
-      } else if (id.value == kNameTag && location.name) {
-        file_.Read(location.name, size.value, &read);
         skip_data = 0;
       }
-      if (skip_data) {
-        file_.Seek(file_.tell() + size.value);
-      }
+    } else if (id.value == kNameTag && location.name) {
+      BufferedFile::Read(location.name, size.value);
+      skip_data = 0;
+    }
+    if (skip_data) {
+      BufferedFile::Skip(size.value);
     }
-
-    file_.Close();
-  }
-  
-  // Refresh all datastructures.
-  if (load_contents) {
-    ForEachObject(location, TouchObject);
   }
-
   return FS_OK;
 }
 
 /* static */
-FilesystemStatus Storage::Save(StorageDir type, const StorageLocation& location) {
-  scoped_resource<SdCardSession> session;
-
-  FilesystemStatus s;
-  char* name = GetFileName(type, location);
-
-  file_.Close();
-  InvalidatePendingSysExTransfer();
+void Storage::WriteRIFF(const StorageLocation& location) {
+  LongWord w;
+  
+  // RIFF header.
+  w.value = kRiffTag;
+  BufferedFile::Write(w.bytes, 4);
+  w.value = 4 + 24 + riff_size(location);
+  BufferedFile::Write(w.bytes, 4);
+  w.value = kFormatTag;
+  BufferedFile::Write(w.bytes, 4);
+  
+  // NAME block.
+  w.value = kNameTag;
+  BufferedFile::Write(w.bytes, 4);
+  w.value = 16;
+  BufferedFile::Write(w.bytes, 4);
+  if (location.name) {
+    BufferedFile::Write(location.name, 16);
+  } else {
+    // History snapshots do not carry a name.
+    uint8_t blank_name[16];
+    memset(blank_name, 0, sizeof(blank_name));
+    BufferedFile::Write(blank_name, sizeof(blank_name));
+  }
+
+  // Write subchunks.
+  ForEachObject(location, &RIFFWriteObject);
+  
+  BufferedFile::Flush();
+}
+
+/* static */
+FilesystemStatus Storage::Load(StorageDir type, const StorageLocation& location, uint8_t load_contents) {
+  {
+    scoped_resource<SdCardSession> session;
+
+    FilesystemStatus s = FS_BAD_FILE_FORMAT;
+  
+    file_.Close();
+    InvalidatePendingSysExTransfer();
+    
+    // In a packed bank, the name or the record of the slot is read directly
+    // at its fixed position.
+    uint32_t end = 0xffffffff;
+    if (type == STORAGE_BANK) {
+      s = OpenPackedBank(location, FA_READ | FA_OPEN_EXISTING);
+      if (s == FS_OK) {
+        if (!load_contents) {
+          s = ReadPackedName(location);
+          file_.Close();
+          return s;
+        }
+        uint32_t start = packed_record_offset(location);
+        BufferedFile::Seek(start);
+        end = start + packed_record_size(location);
+      }
+    }
+    
+    if (s != FS_OK) {
+      s = file_.Open(GetFileName(type, location), FA_READ | FA_OPEN_EXISTING, kFsInitTimeout);
+      if (s != FS_OK) {
+        return s;
+      }
+      BufferedFile::Rewind();
+    }
+    
+    s = ReadRIFF(location, load_contents, end);
+    file_.Close();
+    if (s != FS_OK) {
+      return s;
+    }
+  }
+  
+  // Refresh all datastructures.
+  if (load_contents) {
+    ForEachObject(location, TouchObject);
+  }
+
+  return FS_OK;
+}
+
+/* static */
+FilesystemStatus Storage::Save(StorageDir type, const StorageLocation& location) {
+  scoped_resource<SdCardSession> session;
+
+  FilesystemStatus s;
+
+  file_.Close();
+  InvalidatePendingSysExTransfer();
+  
+  // In a packed bank, the record and the name of the slot are overwritten in
+  // place. There is no backup: the history keeps the previous versions.
+  if (type == STORAGE_BANK &&
+      OpenPackedBank(location, FA_READ | FA_WRITE | FA_OPEN_EXISTING) == FS_OK) {
+    file_.Seek(packed_record_offset(location));
+    BufferedFile::Rewind();
+    WriteRIFF(location);
+    uint16_t written;
+    file_.Seek(packed_name_offset(location));
+    file_.Write(location.name, kPackedBankNameSize, &written);
+    file_.Close();
+    UpdateNameCache(location);
+    UpdatePerformanceSet(location);
+    return FS_OK;
+  }
+  
+  char* name = GetFileName(type, location);
   
   // Create a backup of the older version.
   if (type == STORAGE_CLIPBOARD || (type == STORAGE_BANK && system_settings.data().autobackup())) {
@@ -509,31 +1061,510 @@ FilesystemStatus Storage::Save(StorageDir type, const StorageLocation& location)
     return s;
   }
   
-  LongWord w;
+  BufferedFile::Rewind();
+  WriteRIFF(location);
+  file_.Close();
+  if (type == STORAGE_BANK) {
+    UpdateNameIndex(location);
+    UpdateNameCache(location);
+    UpdatePerformanceSet(location);
+  }
+  return FS_OK;
+}
+
+/* static */
+FilesystemStatus Storage::LoadPerformanceSet() {
+  FilesystemStatus s = InitFilesystem();
+  if (s != FS_OK) {
+    return s;
+  }
+  
+  scoped_resource<SdCardSession> session;
+  
+  file_.Close();
+  set_file_.Close();
+  InvalidatePendingSysExTransfer();
+  memset(performance_set_, 0xff, sizeof(performance_set_));
+  
+  // Parse the list of programs, written as a bank letter followed by a slot
+  // number: "A000 A017 C005...".
+  strcpy_P(tmp_buffer_, PSTR("/PERFSET.TXT"));
+  s = file_.Open(tmp_buffer_, FA_READ | FA_OPEN_EXISTING, kFsInitTimeout);
+  if (s != FS_OK) {
+    return s;
+  }
+  BufferedFile::Rewind();
+  uint8_t size = 0;
+  uint8_t bank = 0xff;
+  uint16_t slot = 0xffff;
+  char c = ' ';
+  while (size < kPerformanceSetSize) {
+    uint8_t end_of_file = !BufferedFile::Read(&c, 1);
+    if (!end_of_file && c >= '0' && c <= '9' && bank != 0xff) {
+      slot = (slot == 0xffff ? 0 : slot * 10) + c - '0';
+      if (slot >= kNumBankSlots) {
+        bank = 0xff;
+      }
+      continue;
+    }
+    if (bank != 0xff && slot != 0xffff) {
+      performance_set_[size++] = wordOr(bank << 8u, slot);
+    }
+    if (end_of_file) {
+      break;
+    }
+    bank = 0xff;
+    slot = 0xffff;
+    if (c >= 'a' && c <= 'z') {
+      c -= 'a' - 'A';
+    }
+    if (c >= 'A' && c <= 'Z') {
+      bank = c - 'A';
+    }
+  }
+  file_.Close();
+  
+  // Copy the programs, one after the other, in the set file.
+  s = OpenPerformanceSet(&set_file_, FA_WRITE | FA_CREATE_ALWAYS);
+  if (s != FS_OK) {
+    memset(performance_set_, 0xff, sizeof(performance_set_));
+    return s;
+  }
+  StorageLocation l {
+    .object = STORAGE_OBJECT_PROGRAM,
+    .part = 0, .alias = 0, .bank = 0, .slot = 0,
+    .name = nullptr
+  };
+  uint16_t record_size = packed_record_size(l);
+  for (uint8_t i = 0; i < size; ++i) {
+    l.bank = highByte(performance_set_[i]);
+    l.slot = lowByte(performance_set_[i]);
+    File* source = nullptr;
+    if (OpenPackedBank(l, FA_READ | FA_OPEN_EXISTING) == FS_OK) {
+      file_.Seek(packed_record_offset(l));
+      source = &file_;
+    } else if (file_.Open(GetFileName(STORAGE_BANK, l), FA_READ | FA_OPEN_EXISTING, kFsInitTimeout) == FS_OK) {
+      source = &file_;
+    }
+    CopyData(source, &set_file_, record_size);
+    file_.Close();
+  }
+  
+  // Commit the file, and keep it open for reading only, so that nothing is
+  // left unwritten if the power goes off.
+  set_file_.Close();
+  s = OpenPerformanceSet(&set_file_, FA_READ | FA_OPEN_EXISTING);
+  if (s != FS_OK) {
+    memset(performance_set_, 0xff, sizeof(performance_set_));
+  }
+  return s;
+}
+
+/* static */
+FilesystemStatus Storage::OpenPerformanceSet(File* file, uint8_t mode) {
+  strcpy_P(tmp_buffer_, PSTR("/PERFSET.BIN"));
+  return file->Open(tmp_buffer_, mode, kFsInitTimeout);
+}
+
+/* static */
+uint8_t Storage::performance_set_index(const StorageLocation& location) {
+  if (location.object != STORAGE_OBJECT_PROGRAM) {
+    return 0xff;
+  }
+  uint16_t bank_slot = location.bank_slot();
+  for (uint8_t i = 0; i < kPerformanceSetSize; ++i) {
+    if (performance_set_[i] == bank_slot) {
+      return i;
+    }
+  }
+  return 0xff;
+}
+
+/* static */
+FilesystemStatus Storage::LoadFromPerformanceSet(const StorageLocation& location) {
+  uint8_t index = performance_set_index(location);
+  if (index == 0xff) {
+    return FS_BAD_FILE_FORMAT;
+  }
+  
+  FilesystemStatus s;
+  {
+    scoped_resource<SdCardSession> session;
+    InvalidatePendingSysExTransfer();
+    
+    uint16_t record_size = packed_record_size(location);
+    uint32_t start = static_cast<uint32_t>(index) * record_size;
+    BufferedFile::Init(&set_file_);
+    BufferedFile::Seek(start);
+    s = ReadRIFF(location, 1, start + record_size);
+    BufferedFile::Init(&file_);
+  }
+  if (s == FS_OK) {
+    ForEachObject(location, TouchObject);
+  }
+  return s;
+}
+
+/* static */
+void Storage::UpdatePerformanceSet(const StorageLocation& location) {
+  uint8_t index = performance_set_index(location);
+  if (index == 0xff) {
+    return;
+  }
+  // The record is written through a short-lived handle, closed right away.
+  // The read-only handle is reopened afterwards, so that it does not keep
+  // stale data.
+  set_file_.Close();
+  if (OpenPerformanceSet(&file_, FA_WRITE | FA_OPEN_EXISTING) == FS_OK) {
+    file_.Seek(static_cast<uint32_t>(index) * packed_record_size(location));
+    BufferedFile::Rewind();
+    WriteRIFF(location);
+    file_.Close();
+  }
+  if (OpenPerformanceSet(&set_file_, FA_READ | FA_OPEN_EXISTING) != FS_OK) {
+    memset(performance_set_, 0xff, sizeof(performance_set_));
+  }
+}
+
+/* static */
+void Storage::CopyProgram(uint8_t source_part, const StorageLocation& location) {
+  if (has_user_changes(location)) {
+    Snapshot(location);
+  }
+  const Part& source = multi.part(source_part);
+  Part& destination = multi.part(location.part);
+  const uint8_t* patch_data = source.raw_patch_data_readonly();
+  for (uint8_t i = 0; i < kNumPatchChunks; ++i) {
+    destination.MergePatchChunk(i, patch_data + i * kPatchChunkSize);
+  }
+  memcpy(
+      destination.raw_data(),
+      source.raw_data_readonly(),
+      PartData::sizeBytes());
+  ForEachObject(location, TouchObject);
+}
+
+/* static */
+uint16_t Storage::packed_record_size(const StorageLocation& location) {
+  // RIFF and format tags, size, and name chunk.
+  return 12 + 24 + riff_size(location);
+}
+
+/* static */
+uint32_t Storage::packed_record_offset(const StorageLocation& location) {
+  return kPackedBankRecordsOffset +
+      static_cast<uint32_t>(packed_record_size(location)) * location.slot;
+}
+
+/* static */
+uint16_t Storage::packed_name_offset(const StorageLocation& location) {
+  return kPackedBankNamesOffset + U8U8Mul(location.slot, kPackedBankNameSize);
+}
+
+/* static */
+uint8_t Storage::CheckPackedBankHeader(
+    File* file,
+    const StorageLocation& location) {
+  PackedBankHeader header;
+  uint16_t read;
+  file->Read(&header, sizeof(header), &read);
+  return read == sizeof(header) &&
+      header.tag == kPackedBankTag &&
+      header.record_size == packed_record_size(location) &&
+      header.object == location.object &&
+      header.num_slots == kNumBankSlots;
+}
+
+/* static */
+FilesystemStatus Storage::OpenPackedBank(
+    const StorageLocation& location,
+    uint8_t mode) {
+  FilesystemStatus s = file_.Open(
+      GetFileName(STORAGE_PACKED_BANK, location),
+      mode,
+      kFsInitTimeout);
+  if (s != FS_OK) {
+    return s;
+  }
+  // A bank packed with objects of a different size is ignored.
+  if (!CheckPackedBankHeader(&file_, location)) {
+    file_.Close();
+    return FS_BAD_FILE_FORMAT;
+  }
+  return FS_OK;
+}
+
+/* static */
+FilesystemStatus Storage::ReadPackedName(const StorageLocation& location) {
+  if (!location.name) {
+    return FS_OK;
+  }
+  uint16_t read;
+  file_.Seek(packed_name_offset(location));
+  file_.Read(location.name, kPackedBankNameSize, &read);
+  // Empty slots have a blank name.
+  return location.name[0] ? FS_OK : FS_BAD_FILE_FORMAT;
+}
+
+/* static */
+void Storage::CopyData(File* source, File* destination, uint16_t size) {
+  uint8_t block[kBufferedFileBlockSize];
+  uint16_t read = 0;
   uint16_t written;
+  while (size) {
+    uint8_t block_size = size > sizeof(block) ? sizeof(block) : size;
+    if (source && read != 0xffff) {
+      source->Read(block, block_size, &read);
+      if (read != block_size) {
+        // Pad a short source with zeros.
+        memset(block + read, 0, block_size - read);
+        read = 0xffff;
+      }
+    } else {
+      memset(block, 0, block_size);
+    }
+    destination->Write(block, block_size, &written);
+    size -= block_size;
+    Yield();
+  }
+}
+
+/* static */
+FilesystemStatus Storage::PackBank(const StorageLocation& location) {
+  scoped_resource<SdCardSession> session;
   
-  // RIFF header.
-  w.value = kRiffTag;
-  file_.Write(w.bytes, 4, &written);
-  w.value = 4 + 24 + riff_size(location);
-  file_.Write(w.bytes, 4, &written);
-  w.value = kFormatTag;
-  file_.Write(w.bytes, 4, &written);
+  file_.Close();
+  InvalidatePendingSysExTransfer();
+
+  // Once packed, the slots are only saved to the packed file. Rebuilding it
+  // from the slot files would lose everything saved since.
+  if (OpenPackedBank(location, FA_READ | FA_OPEN_EXISTING) == FS_OK) {
+    file_.Close();
+    return FS_OK;
+  }
+
+  StorageLocation l = location;
+  char* bank_name = GetFileName(STORAGE_PACKED_BANK, l);
+  FilesystemStatus s = bank_file_.Open(bank_name, FA_WRITE | FA_CREATE_ALWAYS, kFsInitTimeout);
+  if (s == FS_PATH_NOT_FOUND) {
+    fs_.Mkdirs(bank_name);
+    s = bank_file_.Open(bank_name, FA_WRITE | FA_CREATE_ALWAYS, kFsInitTimeout);
+  }
+  if (s != FS_OK) {
+    return s;
+  }
   
-  // NAME block.
-  w.value = kNameTag;
-  file_.Write(w.bytes, 4, &written);
-  w.value = 16;
-  file_.Write(w.bytes, 4, &written);
-  file_.Write(location.name, 16, &written);
+  uint16_t written;
+  PackedBankHeader header;
+  memset(&header, 0, sizeof(header));
+  header.tag = kPackedBankTag;
+  header.record_size = packed_record_size(l);
+  header.object = l.object;
+  header.num_slots = kNumBankSlots;
+  bank_file_.Write(&header, sizeof(header), &written);
+  
+  // The names are written first, then the records. Missing slots are left
+  // blank.
+  WriteNames(l, &bank_file_);
+  for (l.slot = 0; l.slot < kNumBankSlots; ++l.slot) {
+    File* source = nullptr;
+    if (file_.Open(GetFileName(STORAGE_BANK, l), FA_READ | FA_OPEN_EXISTING, kFsInitTimeout) == FS_OK) {
+      source = &file_;
+    }
+    CopyData(source, &bank_file_, header.record_size);
+    file_.Close();
+  }
+  bank_file_.Close();
+  InvalidateNameCache();
+  return FS_OK;
+}
 
-  // Write subchunks.
-  ForEachObject(location, &RIFFWriteObject);
+/* static */
+void Storage::WriteNames(const StorageLocation& location, File* destination) {
+  StorageLocation l = location;
+  char name[kPackedBankNameSize];
+  l.name = name;
+  uint16_t written;
+  for (l.slot = 0; l.slot < kNumBankSlots; ++l.slot) {
+    memset(name, 0, sizeof(name));
+    if (file_.Open(GetFileName(STORAGE_BANK, l), FA_READ | FA_OPEN_EXISTING, kFsInitTimeout) == FS_OK) {
+      BufferedFile::Rewind();
+      ReadRIFF(l, 0, 0xffffffff);
+      file_.Close();
+    }
+    destination->Write(name, sizeof(name), &written);
+    Yield();
+  }
+}
+
+/* static */
+FilesystemStatus Storage::UnpackBank(const StorageLocation& location) {
+  scoped_resource<SdCardSession> session;
+  
+  file_.Close();
+  InvalidatePendingSysExTransfer();
+
+  StorageLocation l = location;
+  FilesystemStatus s = bank_file_.Open(
+      GetFileName(STORAGE_PACKED_BANK, l),
+      FA_READ | FA_OPEN_EXISTING,
+      kFsInitTimeout);
+  if (s != FS_OK) {
+    return s;
+  }
+  if (!CheckPackedBankHeader(&bank_file_, l)) {
+    bank_file_.Close();
+    return FS_BAD_FILE_FORMAT;
+  }
+  
+  uint16_t record_size = packed_record_size(l);
+  for (l.slot = 0; l.slot < kNumBankSlots; ++l.slot) {
+    LongWord id;
+    uint16_t read;
+    bank_file_.Seek(packed_record_offset(l));
+    bank_file_.Read(id.bytes, 4, &read);
+    if (id.value != kRiffTag) {
+      continue;
+    }
+    bank_file_.Seek(packed_record_offset(l));
+    
+    char* name = GetFileName(STORAGE_BANK, l);
+    s = file_.Open(name, FA_WRITE | FA_CREATE_ALWAYS, kFsInitTimeout);
+    if (s == FS_PATH_NOT_FOUND) {
+      fs_.Mkdirs(name);
+      s = file_.Open(name, FA_WRITE | FA_CREATE_ALWAYS, kFsInitTimeout);
+    }
+    if (s != FS_OK) {
+      bank_file_.Close();
+      return s;
+    }
+    CopyData(&bank_file_, &file_, record_size);
+    file_.Close();
+  }
+  
+  // The name table of the packed bank becomes the name index.
+  if (file_.Open(GetFileName(STORAGE_NAME_INDEX, l), FA_WRITE | FA_CREATE_ALWAYS, kFsInitTimeout) == FS_OK) {
+    bank_file_.Seek(kPackedBankNamesOffset);
+    CopyData(&bank_file_, &file_, kNumBankSlots * kPackedBankNameSize);
+    file_.Close();
+  }
+  bank_file_.Close();
+  
+  // Back to one file per slot.
+  fs_.Unlink(GetFileName(STORAGE_PACKED_BANK, l));
+  InvalidateNameCache();
+  return FS_OK;
+}
+
+/* static */
+FilesystemStatus Storage::RebuildNameIndex(const StorageLocation& location) {
+  scoped_resource<SdCardSession> session;
+  
+  file_.Close();
+  InvalidatePendingSysExTransfer();
+  
+  // A packed bank has its own name table.
+  if (OpenPackedBank(location, FA_READ | FA_OPEN_EXISTING) == FS_OK) {
+    file_.Close();
+    return FS_OK;
+  }
+  
+  char* index_name = GetFileName(STORAGE_NAME_INDEX, location);
+  FilesystemStatus s = bank_file_.Open(index_name, FA_WRITE | FA_CREATE_ALWAYS, kFsInitTimeout);
+  if (s == FS_PATH_NOT_FOUND) {
+    fs_.Mkdirs(index_name);
+    s = bank_file_.Open(index_name, FA_WRITE | FA_CREATE_ALWAYS, kFsInitTimeout);
+  }
+  if (s != FS_OK) {
+    return s;
+  }
+  WriteNames(location, &bank_file_);
+  bank_file_.Close();
+  InvalidateNameCache();
+  return FS_OK;
+}
+
+/* static */
+FilesystemStatus Storage::LoadName(const StorageLocation& location) {
+  uint8_t base = location.slot & ~(kNameCacheSize - 1);
+  if (name_cache_base_ != base ||
+      name_cache_bank_ != location.bank ||
+      name_cache_object_ != location.object) {
+    if (FillNameCache(location, base) != FS_OK) {
+      // No name index for this bank: read the name from the slot file.
+      InvalidateNameCache();
+      return Load(STORAGE_BANK, location, 0);
+    }
+  }
+  if (location.name) {
+    memcpy(
+        location.name,
+        name_cache_[location.slot - base],
+        kPackedBankNameSize);
+  }
+  return name_cache_[location.slot - base][0] ? FS_OK : FS_BAD_FILE_FORMAT;
+}
+
+/* static */
+FilesystemStatus Storage::FillNameCache(const StorageLocation& location, uint8_t base) {
+  scoped_resource<SdCardSession> session;
   
   file_.Close();
+  InvalidatePendingSysExTransfer();
+  
+  // Read the names of the neighbouring slots at once, from the name table of
+  // the packed bank, or from the name index.
+  FilesystemStatus s = OpenPackedBank(location, FA_READ | FA_OPEN_EXISTING);
+  uint16_t offset = kPackedBankNamesOffset;
+  if (s != FS_OK) {
+    s = file_.Open(
+        GetFileName(STORAGE_NAME_INDEX, location),
+        FA_READ | FA_OPEN_EXISTING,
+        kFsInitTimeout);
+    offset = 0;
+  }
+  if (s != FS_OK) {
+    return s;
+  }
+  uint16_t read;
+  file_.Seek(offset + U8U8Mul(base, kPackedBankNameSize));
+  file_.Read(name_cache_, sizeof(name_cache_), &read);
+  file_.Close();
+  if (read != sizeof(name_cache_)) {
+    return FS_BAD_FILE_FORMAT;
+  }
+  name_cache_base_ = base;
+  name_cache_bank_ = location.bank;
+  name_cache_object_ = location.object;
   return FS_OK;
 }
 
+/* static */
+void Storage::UpdateNameIndex(const StorageLocation& location) {
+  uint16_t written;
+  if (file_.Open(
+          GetFileName(STORAGE_NAME_INDEX, location),
+          FA_WRITE | FA_OPEN_EXISTING,
+          kFsInitTimeout) == FS_OK) {
+    file_.Seek(U8U8Mul(location.slot, kPackedBankNameSize));
+    file_.Write(location.name, kPackedBankNameSize, &written);
+    file_.Close();
+  }
+}
+
+/* static */
+void Storage::UpdateNameCache(const StorageLocation& location) {
+  uint8_t base = location.slot & ~(kNameCacheSize - 1);
+  if (name_cache_base_ == base &&
+      name_cache_bank_ == location.bank &&
+      name_cache_object_ == location.object) {
+    memcpy(
+        name_cache_[location.slot - base],
+        location.name,
+        kPackedBankNameSize);
+  }
+}
+
 /* static */
 char* Storage::GetFileName(StorageDir type, const StorageLocation& location) {
   char* p = tmp_buffer_;
@@ -550,16 +1581,19 @@ char* Storage::GetFileName(StorageDir type, const StorageLocation& location) {
     strcat_P(p, PSTR("/CLIPBRD/CLIPBRD"));
     p += strlen(p);
   } else if (type == STORAGE_HISTORY) {
-    strcat_P(p, PSTR("/HISTORY/"));
-    p += strlen(p);
-    if (location.object != STORAGE_OBJECT_MULTI) {
-      *p++ = '0' + (location.part);
-      *p++ = '/';
-    }
-  } else if (type == STORAGE_BANK) {
+    strcat_P(p, PSTR("/HISTORY.JNL"));
+    return tmp_buffer_;
+  } else {
     strcat_P(p, PSTR("/BANK/"));
     p += strlen(p);
     *p++ = 'A' + (location.bank);
+    if (type == STORAGE_PACKED_BANK) {
+      strcpy_P(p, PSTR(".PAK"));
+      return tmp_buffer_;
+    } else if (type == STORAGE_NAME_INDEX) {
+      strcpy_P(p, PSTR(".NAM"));
+      return tmp_buffer_;
+    }
     *p++ = '/';
   }
   
@@ -674,7 +1708,64 @@ void Storage::SysExParseCommand() {
         sysex_rx_expected_size_ = object_size(location);
       }
       break;
+    
+    case 0x21:
+    case 0x22:
+    case 0x23:
+    case 0x24:
+    case 0x25:
+      // Same objects, in the packed format.
+      {
+        StorageLocation location {
+          .object = static_cast<StorageObject>(sysex_rx_command_[0] - 0x21),
+          .part = 0,
+          .alias = 0,
+          .bank = 0,
+          .slot = 0,
+          .name = nullptr
+        };
+        sysex_rx_expected_size_ = object_size(location);
+      }
+      break;
+      
+    case 0x41:
+    case 0x42:
+    case 0x43:
+    case 0x44:
+    case 0x45:
+      // Bank record: bank + RIFF image of the slot given as argument.
+      sysex_rx_location_.object = static_cast<StorageObject>(
+          sysex_rx_command_[0] - 0x41);
+      sysex_rx_location_.slot = sysex_rx_command_[1];
+      sysex_rx_record_flags_ = 0xff;
+      sysex_rx_expected_size_ = 1 + packed_record_size(sysex_rx_location_);
+      break;
+    
+    case 0x51:
+    case 0x52:
+    case 0x53:
+    case 0x54:
+    case 0x55:
+      // Bank dump request: first slot to send.
+      sysex_rx_expected_size_ = 1;
+      break;
+      
+    case 0x60:
+    case 0x61:
+      // Acknowledgement of a bank record.
+      sysex_rx_expected_size_ = 0;
+      break;
+      
+    case 0x70:
+      // Profiler report request.
+      sysex_rx_expected_size_ = 0;
+      break;
       
+    case 0x72:
+      // Voicecard statistics request.
+      sysex_rx_expected_size_ = 0;
+      break;
+    
     case 0x0f:
       // POKE command contains 2 bytes of address + $argument bytes of data.
       {
@@ -687,6 +1778,11 @@ void Storage::SysExParseCommand() {
     case 0x13:
     case 0x14:
     case 0x15:
+    case 0x31:
+    case 0x32:
+    case 0x33:
+    case 0x34:
+    case 0x35:
       // Request commands have no data.
       sysex_rx_expected_size_ = 0;
       break;
@@ -726,6 +1822,16 @@ void Storage::SysExAcceptCommand() {
       TouchObject(location);
       break;
 
+    case 0x21:
+    case 0x22:
+    case 0x23:
+    case 0x24:
+    case 0x25:
+      location.object = static_cast<StorageObject>(sysex_rx_command_[0] - 0x21);
+      ReadObject(location);
+      TouchObject(location);
+      break;
+
     case 0x0f:
       // POKE
       {
@@ -746,6 +1852,92 @@ void Storage::SysExAcceptCommand() {
       location.object = static_cast<StorageObject>(sysex_rx_command_[0] - 0x11);
       SysExSend(location);
       break;
+
+    case 0x31:
+    case 0x32:
+    case 0x33:
+    case 0x34:
+    case 0x35:
+      location.object = static_cast<StorageObject>(sysex_rx_command_[0] - 0x31);
+      SysExSendPacked(location);
+      break;
+      
+    case 0x41:
+    case 0x42:
+    case 0x43:
+    case 0x44:
+    case 0x45:
+      success = SysExAcceptBankRecord();
+      SysExSendPackedRaw(
+          success ? 0x60 : 0x61,
+          sysex_rx_location_.slot,
+          nullptr,
+          0);
+      break;
+    
+    case 0x51:
+    case 0x52:
+    case 0x53:
+    case 0x54:
+    case 0x55:
+      if (sysex_rx_command_[1] >= kNumBanks) {
+        success = 0;
+        break;
+      }
+      sysex_tx_location_.object = static_cast<StorageObject>(
+          sysex_rx_command_[0] - 0x51);
+      sysex_tx_location_.bank = sysex_rx_command_[1];
+      sysex_tx_location_.slot = buffer_[0];
+      sysex_tx_bank_dump_ = 1;
+      SysExSendBankRecord();
+      break;
+    
+    case 0x60:
+    case 0x61:
+      // The host has received a record (0x60) and asks for the next one, or
+      // asks for the same one again (0x61). A dump can thus be resumed by
+      // requesting it again from the last acknowledged slot.
+      if (!sysex_tx_bank_dump_ ||
+          sysex_rx_command_[1] != sysex_tx_location_.slot) {
+        success = 0;
+        break;
+      }
+      if (sysex_rx_command_[0] == 0x60) {
+        ++sysex_tx_location_.slot;
+      }
+      SysExSendBankRecord();
+      break;
+      
+    case 0x70:
+      // Profiler report: min/average/max duration of each channel, in us. The
+      // statistics are reset if the argument is 1.
+      {
+        uint8_t report[PROFILER_CHANNEL_LAST * 3 * 2];
+        uint8_t size = profiler.Report(report);
+        SysExSendPackedRaw(0x71, PROFILER_CHANNEL_LAST, report, size);
+        if (sysex_rx_command_[1] == 1) {
+          profiler.Reset();
+        }
+      }
+      break;
+      
+    case 0x72:
+      // Runtime statistics of the voicecard given as argument.
+      {
+        uint8_t voice_id = sysex_rx_command_[1];
+        VoicecardStats stats;
+        if (voice_id >= kNumVoices ||
+            !voicecard_tx.GetStats(voice_id, &stats)) {
+          success = 0;
+          break;
+        }
+        SysExSendPackedRaw(
+            0x73,
+            voice_id,
+            reinterpret_cast<const uint8_t*>(&stats),
+            kVoicecardStatsSize);
+      }
+      break;
       
     case 0x1f:
       // PEEK
@@ -768,6 +1960,10 @@ void Storage::SysExAcceptCommand() {
 
 /* static */
 void Storage::SysExReceive(uint8_t byte) {
+  if (yielding_) {
+    // The buffer is in use by the filesystem.
+    return;
+  }
   if (byte == 0xf0) {
     sysex_rx_checksum_ = 0;
     sysex_rx_bytes_received_ = 0;
@@ -797,7 +1993,33 @@ void Storage::SysExReceive(uint8_t byte) {
       break;
 
     case RECEIVING_DATA:
-      {
+      if (sysex_rx_command_[0] >= 0x20) {
+        // Packed format: a byte with the most significant bits of the group,
+        // followed by up to 7 bytes. The checksum is the last byte.
+        uint8_t position = byteAnd(lowByte(sysex_rx_bytes_received_), 7);
+        uint16_t i = (sysex_rx_bytes_received_ >> 3) * 7 + position - 1;
+        sysex_rx_bytes_received_++;
+        if (position == 0) {
+          sysex_rx_packed_msbs_ = byte;
+          break;
+        }
+        --position;
+        if (sysex_rx_packed_msbs_ & (1 << position)) {
+          byte |= 0x80;
+        }
+        if (i < sysex_rx_expected_size_) {
+          sysex_rx_checksum_ += byte;
+          if (byteAnd(sysex_rx_command_[0], 0xf0) == 0x40) {
+            // Bank records do not fit in the buffer.
+            SysExReceiveRecordByte(i, byte);
+          } else {
+            buffer_[i] = byte;
+          }
+        } else {
+          sysex_rx_received_checksum_ = byte;
+          sysex_rx_state_ = RECEIVING_FOOTER;
+        }
+      } else {
         uint16_t i = sysex_rx_bytes_received_ / 2;
         if (sysex_rx_bytes_received_ & 1u) {
           buffer_[i] |= byte & 0xfu;
@@ -815,10 +2037,18 @@ void Storage::SysExReceive(uint8_t byte) {
     break;
 
   case RECEIVING_FOOTER:
-    bool checksum_ok = sysex_rx_checksum_ == buffer_[sysex_rx_expected_size_];
+    uint8_t received_checksum = sysex_rx_command_[0] >= 0x20
+        ? sysex_rx_received_checksum_
+        : buffer_[sysex_rx_expected_size_];
+    bool checksum_ok = sysex_rx_checksum_ == received_checksum;
     if (byte == 0xf7 && checksum_ok && system_settings.rx_sysex()) {
       SysExAcceptCommand();
     } else {
+      if (byteAnd(sysex_rx_command_[0], 0xf0) == 0x40 &&
+          system_settings.rx_sysex()) {
+        // Ask the host to send the bank record again.
+        SysExSendPackedRaw(0x61, sysex_rx_location_.slot, nullptr, 0);
+      }
       sysex_rx_state_ = RECEPTION_ERROR;
     }
     break;
@@ -829,6 +2059,22 @@ void Storage::SysExReceive(uint8_t byte) {
 void Storage::InvalidatePendingSysExTransfer() {
   sysex_rx_state_ = RECEPTION_ERROR;
 }
+
+/* static */
+void Storage::Yield() {
+  uint32_t now = milliseconds();
+  if (!yield_fn_ || yielding_ || now - last_yield_time_ < kStorageSliceDuration) {
+    return;
+  }
+  // The SysEx receiver shares its buffer with the filesystem.
+  InvalidatePendingSysExTransfer();
+  voicecard_tx.EndSdCard();
+  yielding_ = 1;
+  (*yield_fn_)();
+  yielding_ = 0;
+  voicecard_tx.BeginSdCard();
+  last_yield_time_ = milliseconds();
+}
   
 /* extern */
 Storage storage;
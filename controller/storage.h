@@ -53,9 +53,24 @@ enum StorageDir {
   STORAGE_BANK,
   STORAGE_CLIPBOARD,
   STORAGE_PREVIOUS_CLIPBOARD,
-  STORAGE_HISTORY
+  STORAGE_HISTORY,
+  STORAGE_PACKED_BANK,
+  STORAGE_NAME_INDEX
 };
 
+// Banks are named by a letter.
+static const uint8_t kNumBanks = 26;
+static const uint8_t kNumBankSlots = 128;
+static const uint8_t kPackedBankNameSize = 16;
+// Number of neighbouring slot names kept in RAM while browsing.
+static const uint8_t kNameCacheSize = 8;
+static const uint8_t kPerformanceSetSize = 16;
+// Number of versions of an object kept in the history journal, per part.
+// Must divide 256, so that the ring follows the wrapping of version numbers.
+static const uint8_t kHistoryDepth = 16;
+// Maximum duration, in ms, of a slice of storage operation.
+static const uint8_t kStorageSliceDuration = 2;
+
 struct StorageLocation {
   StorageObject object;
   uint8_t part;
@@ -88,7 +103,9 @@ class Storage {
   static void Init();
   static FilesystemStatus InitFilesystem() {
     scoped_resource<SdCardSession> session;
-    return fs_.Init(kFsInitTimeout);
+    FilesystemStatus s = fs_.Init(kFsInitTimeout);
+    filesystem_ready_ = s == FS_OK;
+    return s;
   }
 
   static inline void Tick() {
@@ -100,10 +117,19 @@ class Storage {
   static void SysExSend(const StorageLocation& location) {
     ForEachObject(location, &SysExSendObject);
   }
+  // Same as SysExSend, with 8 bytes packed in 7 instead of sent as nibbles.
+  static void SysExSendPacked(const StorageLocation& location) {
+    ForEachObject(location, &SysExSendPackedObject);
+  }
   
+  // Successive versions of an object are recorded in a ring of fixed-size
+  // records, in a single journal file per object type.
   static void Snapshot(const StorageLocation& location);
   static FilesystemStatus PreviousVersion(const StorageLocation& location);
   static FilesystemStatus NextVersion(const StorageLocation& location);
+  // Records the program of a part if it has been edited since its last
+  // snapshot. Does nothing if the card has not been mounted yet.
+  static void SnapshotEdits(uint8_t part);
   
   static FilesystemStatus Copy(const StorageLocation& location) {
     return Save(STORAGE_CLIPBOARD, location);
@@ -121,17 +147,34 @@ class Storage {
     if (has_user_changes(location)) {
       Snapshot(location);
     }
+    if (LoadFromPerformanceSet(location) == FS_OK) {
+      return FS_OK;
+    }
     return Load(STORAGE_BANK, location, 1);
   }
   
-  static FilesystemStatus LoadName(const StorageLocation location) {
-    return Load(STORAGE_BANK, location, 0);
-  }
+  // The programs of the performance set, listed in /PERFSET.TXT, are copied
+  // one after the other in /PERFSET.BIN. This file is kept open, so loading
+  // them does not involve any directory lookup.
+  static FilesystemStatus LoadPerformanceSet();
+  // Copies the program of a part already loaded into another part.
+  static void CopyProgram(uint8_t source_part, const StorageLocation& location);
+  
+  // Names are read from the name index of the bank (or from the name table
+  // of a packed bank) when there is one, by windows of kNameCacheSize slots.
+  static FilesystemStatus LoadName(const StorageLocation& location);
+  static FilesystemStatus RebuildNameIndex(const StorageLocation& location);
   
   static FilesystemStatus Save(const StorageLocation& location) {
     return Save(STORAGE_BANK, location);
   }
   
+  // Imports all the slots of a bank into a single packed file, from which
+  // they are then loaded and saved. UnpackBank() exports them back to one
+  // file per slot. A bank which is already packed is left untouched.
+  static FilesystemStatus PackBank(const StorageLocation& location);
+  static FilesystemStatus UnpackBank(const StorageLocation& location);
+  
   static FilesystemStatus Mkfs() {
     scoped_resource<SdCardSession> session;
     InvalidatePendingSysExTransfer();
@@ -169,15 +212,57 @@ class Storage {
 
   static void WriteMultiToEeprom();
   static uint8_t LoadMultiFromEeprom();
+  
+  // Long storage operations are cut in slices. Between two slices, the SD card
+  // releases the SPI bus to the voicecards, and this function is called to
+  // process MIDI input and clocks, so that playing does not freeze.
+  static inline void set_yield_fn(void (*yield_fn)()) {
+    yield_fn_ = yield_fn;
+  }
+  // True while the yield function is running. Storage operations requested
+  // at this time must be deferred.
+  static inline uint8_t busy() { return yielding_; }
 
  private:
   static void InvalidatePendingSysExTransfer();
+  static void Yield();
   
   static void Expand(const char* name, char variable);
   
   static FilesystemStatus Save(StorageDir type, const StorageLocation& location);
 
   static FilesystemStatus Load(StorageDir type, const StorageLocation& location, uint8_t load_contents);
+  
+  static FilesystemStatus ReadRIFF(const StorageLocation& location, uint8_t load_contents, uint32_t end);
+  static void WriteRIFF(const StorageLocation& location);
+  
+  static uint16_t packed_record_size(const StorageLocation& location);
+  static uint32_t packed_record_offset(const StorageLocation& location);
+  static uint16_t packed_name_offset(const StorageLocation& location);
+  static uint8_t CheckPackedBankHeader(avrlib::File* file, const StorageLocation& location);
+  static FilesystemStatus OpenPackedBank(const StorageLocation& location, uint8_t mode);
+  static FilesystemStatus ReadPackedName(const StorageLocation& location);
+  static void CopyData(avrlib::File* source, avrlib::File* destination, uint16_t size);
+  static void WriteNames(const StorageLocation& location, avrlib::File* destination);
+  
+  static FilesystemStatus FillNameCache(const StorageLocation& location, uint8_t base);
+  static void UpdateNameIndex(const StorageLocation& location);
+  static void UpdateNameCache(const StorageLocation& location);
+  static inline void InvalidateNameCache() {
+    name_cache_base_ = 0xff;
+  }
+  
+  static FilesystemStatus OpenHistory(const StorageLocation& location);
+  static uint32_t history_record_offset(
+      const StorageLocation& location,
+      uint8_t version);
+  static void WriteHistoryRecord(const StorageLocation& location, uint8_t version);
+  static FilesystemStatus LoadHistoryRecord(const StorageLocation& location, uint8_t version);
+  
+  static FilesystemStatus OpenPerformanceSet(avrlib::File* file, uint8_t mode);
+  static uint8_t performance_set_index(const StorageLocation& location);
+  static FilesystemStatus LoadFromPerformanceSet(const StorageLocation& location);
+  static void UpdatePerformanceSet(const StorageLocation& location);
 
   static char* GetFileName(StorageDir type, const StorageLocation& location);
 
@@ -191,6 +276,20 @@ class Storage {
   static void ReadObject(const StorageLocation& location);
   static void SysExSendObject(const StorageLocation& location);
   static void SysExSendRaw(uint8_t, uint8_t, const uint8_t*, uint8_t, bool);
+  static void SysExSendPackedObject(const StorageLocation& location);
+  static void SysExSendPackedRaw(uint8_t, uint8_t, const uint8_t*, uint8_t);
+  static void SysExBeginPacked(uint8_t command, uint8_t argument);
+  static void SysExPack(const uint8_t* data, uint8_t size);
+  static void SysExSendPackedGroup();
+  static void SysExEndPacked();
+  
+  // Whole banks are transferred one record per message, each acknowledged by
+  // the receiver. Records are streamed between the card and MIDI, and never
+  // stored as a whole in RAM.
+  static uint8_t OpenBankRecord(const StorageLocation& location);
+  static void SysExSendBankRecord();
+  static void SysExReceiveRecordByte(uint16_t index, uint8_t byte);
+  static uint8_t SysExAcceptBankRecord();
   static void RIFFWriteObject(const StorageLocation& location);
   static void TouchObject(const StorageLocation& location);
 
@@ -207,13 +306,42 @@ class Storage {
   static uint8_t sysex_rx_state_;
   static uint8_t sysex_rx_checksum_;
   static uint8_t sysex_rx_command_[2];
+  // Most significant bits of the group of 7 bytes being received, in the
+  // packed format.
+  static uint8_t sysex_rx_packed_msbs_;
+  static uint8_t sysex_rx_received_checksum_;
+  
+  static StorageLocation sysex_rx_location_;
+  // 0 while a record is being written to the scratch file, 0xff when it could
+  // not be opened.
+  static uint8_t sysex_rx_record_flags_;
+  static char sysex_rx_name_[kPackedBankNameSize];
+  static StorageLocation sysex_tx_location_;
+  static uint8_t sysex_tx_bank_dump_;
+  
+  static uint8_t sysex_tx_group_[7];
+  static uint8_t sysex_tx_group_size_;
+  static uint8_t sysex_tx_checksum_;
   
   static char tmp_buffer_[64];
   
   static uint8_t version_[kNumVoices * 3 + 1];
   
   static avrlib::Filesystem fs_;
+  static uint8_t filesystem_ready_;
   static avrlib::File file_;
+  static avrlib::File bank_file_;
+  static avrlib::File set_file_;
+  static uint16_t performance_set_[kPerformanceSetSize];
+  
+  static void (*yield_fn_)();
+  static uint8_t yielding_;
+  static uint32_t last_yield_time_;
+  
+  static char name_cache_[kNameCacheSize][kPackedBankNameSize];
+  static uint8_t name_cache_base_;
+  static uint8_t name_cache_bank_;
+  static uint8_t name_cache_object_;
   
   DISALLOW_COPY_AND_ASSIGN(Storage);
 };
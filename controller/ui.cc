@@ -25,6 +25,7 @@
 #include "controller/leds.h"
 #include "controller/multi.h"
 #include "controller/resources.h"
+#include "controller/storage.h"
 #include "controller/system_settings.h"
 
 #include "controller/ui_pages/card_info_page.h"
@@ -104,7 +105,7 @@ constexpr PageInfo page_registry[] PROGMEM = {
   
   { PAGE_MULTI_CLOCK,
     &ParameterEditor::event_handlers_,
-    { 62, 63, 64, 65, 0xff, 0xff, 0xff, 0xff, },
+    { 62, 63, 64, 65, 75, 0xff, 0xff, 0xff, },
     PAGE_MULTI, 5, 0x0f,
   },
   
@@ -320,6 +321,9 @@ void Ui::DoEvents() {
         } else {
           int8_t new_part = state_.active_part() + e.value;
           new_part = Clip(new_part, 0, kNumParts - 1);
+          if (new_part != state_.active_part()) {
+            storage.SnapshotEdits(state_.active_part());
+          }
           state_.active_part() = new_part;
         }
         break;
@@ -391,6 +395,11 @@ void Ui::ShowPage(UiPageNumber page, uint8_t initialize) {
   queue_.Touch();
   pots_.Lock(16);
   
+  // Leaving an editing page: the edits made on it are recorded in the history.
+  if (page != active_page_ && active_page_ <= PAGE_KNOB_ASSIGN) {
+    storage.SnapshotEdits(state_.active_part());
+  }
+  
   if (page <= PAGE_KNOB_ASSIGN) {
     most_recent_non_system_page_ = page;
   }
@@ -144,7 +144,8 @@ uint8_t Library::OnKey(uint8_t key) {
 
 enum DialogId : uint8_t {
   DIALOG_ID_INIT = 1,
-
+  DIALOG_ID_PACK_BANK = 4,
+  DIALOG_ID_UNPACK_BANK = 5,
 };
 
 /* static */
@@ -234,6 +235,34 @@ uint8_t Library::OnKeyBrowse(uint8_t key) {
         ui.ShowPage(PAGE_OS_INFO);
         break;
         
+      case SWITCH_4:
+      case SWITCH_5:
+        {
+          Dialog d {
+            .dialog_type = DIALOG_CONFIRM,
+            .num_choices = 0,
+            .first_choice = 0,
+            .text = key == SWITCH_4
+                ? PSTR("pack bank into a single file?")
+                : PSTR("unpack bank to one file/slot?"),
+            .user_text = nullptr
+          };
+          ui.ShowDialogBox(
+              key == SWITCH_4 ? DIALOG_ID_PACK_BANK : DIALOG_ID_UNPACK_BANK,
+              d,
+              0);
+        }
+        break;
+        
+      case SWITCH_6:
+        // Rebuild the name index, after files have been copied to the card.
+        display.set_status('>');
+        if (storage.RebuildNameIndex(location_) != FS_OK) {
+          ShowDiskErrorMessage();
+        }
+        Browse();
+        break;
+        
       case SWITCH_7:
         more_ ^= 1;
         break;
@@ -312,8 +341,12 @@ void Library::UpdateScreen() {
   if (action_ == LIBRARY_ACTION_BROWSE) {
     buffer = display.line_buffer(1) + 1;
     if (more_) {
-      strncpy_P(&buffer[0], PSTR("pref|~ini|about               more|exit"), 39);
+      strncpy_P(&buffer[0], PSTR("pref|~ini|about|pak|unpk|idx  more|exit"), 39);
       buffer[4] = kDelimiter;
+      buffer[9] = kDelimiter;
+      buffer[15] = kDelimiter;
+      buffer[19] = kDelimiter;
+      buffer[24] = kDelimiter;
     } else {
       strncpy_P(&buffer[0], PSTR(" |   init|send|save|versions  more|exit"), 39);
       buffer[9] = kDelimiter;
@@ -349,7 +382,7 @@ void Library::UpdateLeds() {
   leds.set_pixel(LED_8, 0xf0);
   leds.set_pixel(LED_7, 0x0f);
   if (action_ == LIBRARY_ACTION_BROWSE) {
-    uint8_t loop_end = more_ ? 3 : 5;
+    uint8_t loop_end = more_ ? 6 : 5;
     for (uint8_t i = 0; i < loop_end; ++i) {
       leds.set_pixel(LED_1 + i, 0x0f);
     }
@@ -407,6 +440,19 @@ void Library::OnDialogClosed(uint8_t dialog_id, uint8_t return_value) {
         Storage::WriteMultiToEeprom();
       }
       break;
+      
+    case DIALOG_ID_PACK_BANK:
+    case DIALOG_ID_UNPACK_BANK:
+      if (return_value) {
+        display.set_status('>');
+        FilesystemStatus s = dialog_id == DIALOG_ID_PACK_BANK
+            ? storage.PackBank(location_)
+            : storage.UnpackBank(location_);
+        if (s != FS_OK) {
+          ShowDiskErrorMessage();
+        }
+      }
+      break;
     default:
       break;
   }
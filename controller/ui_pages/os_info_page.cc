@@ -26,7 +26,9 @@
 
 #include "controller/display.h"
 #include "controller/leds.h"
+#include "controller/midi_dispatcher.h"
 #include "controller/multi.h"
+#include "controller/profiler.h"
 #include "controller/storage.h"
 
 namespace ambika {
@@ -34,10 +36,32 @@ namespace ambika {
 /* static */
 uint8_t OsInfoPage::found_firmware_files_;
 
+/* static */
+uint8_t OsInfoPage::view_;
+
+/* static */
+uint8_t OsInfoPage::profiler_channel_;
+
+/* static */
+uint8_t OsInfoPage::tx_priority_ = TX_PRIORITY_REALTIME;
+
+static constexpr char profiler_channel_names[] PROGMEM =
+    "timer1  "
+    "timer2  "
+    "midi in "
+    "clocks  "
+    "ui      "
+    "sd card ";
+
+static constexpr char tx_priority_names[] PROGMEM =
+    "realtime"
+    "bulk    ";
+
 /* static */
 void OsInfoPage::OnInit(PageInfo* info) {
   IGNORE_UNUSED(info);
   active_control_ = 0;
+  view_ = OS_INFO_VIEW_VERSIONS;
   FindFirmwareFiles();
 }
 
@@ -55,6 +79,25 @@ void OsInfoPage::FindFirmwareFiles() {
 
 /* static */
 uint8_t OsInfoPage::OnIncrement(int8_t increment) {
+  if (view_ == OS_INFO_VIEW_LOAD) {
+    profiler_channel_ = Clip(
+        profiler_channel_ + increment,
+        0_u8,
+        U8(PROFILER_CHANNEL_LAST - 1));
+    return 1;
+  } else if (view_ == OS_INFO_VIEW_VOICECARD_TX) {
+    tx_priority_ = Clip(
+        tx_priority_ + increment,
+        U8(TX_PRIORITY_REALTIME),
+        U8(TX_PRIORITY_BULK));
+    return 1;
+  } else if (view_ == OS_INFO_VIEW_CARD_STATS) {
+    active_control_ = Clip(
+        active_control_ + increment,
+        0_u8,
+        U8(kNumVoices - 1));
+    return 1;
+  }
   active_control_ = Clip(active_control_ + increment, 0_u8, kNumVoices);
   FindFirmwareFiles();
   // TODO figure out what the return value does
@@ -63,6 +106,9 @@ uint8_t OsInfoPage::OnIncrement(int8_t increment) {
 
 /* static */
 uint8_t OsInfoPage::OnKey(uint8_t key) {
+  if (view_ != OS_INFO_VIEW_VERSIONS && key < SWITCH_6) {
+    return 1;
+  }
   switch(key) {
     default:
       break;
@@ -98,6 +144,26 @@ uint8_t OsInfoPage::OnKey(uint8_t key) {
       }
       break;
       
+    case SWITCH_6:
+      ++view_;
+      if (view_ == OS_INFO_VIEW_LAST) {
+        view_ = OS_INFO_VIEW_VERSIONS;
+      }
+      break;
+      
+    case SWITCH_7:
+      if (view_ == OS_INFO_VIEW_MIDI_STATS) {
+        midi_dispatcher.ResetInputStats();
+      } else if (view_ == OS_INFO_VIEW_LOAD) {
+        profiler.Reset();
+      } else if (view_ == OS_INFO_VIEW_VOICECARD_TX) {
+        voicecard_tx.ResetQueueingStats();
+        voicecard_tx.ResetWriteCounts();
+      } else if (view_ == OS_INFO_VIEW_CARD_STATS) {
+        voicecard_tx.ResetStats(active_control_);
+      }
+      break;
+      
     case SWITCH_8:
       ui.ShowPreviousPage();
       break;
@@ -113,8 +179,171 @@ void OsInfoPage::PrintVersionNumber(char* buffer, uint8_t number) {
   *buffer++ = '0' + lowNibble(number);
 }
 
+/* static */
+void OsInfoPage::PrintCount(char* buffer, uint16_t count) {
+  if (count > 9999) {
+    count = 9999;
+  }
+  UnsafeItoa<int16_t>(count, 4, buffer);
+  AlignRight(buffer, 4);
+}
+
+/* static */
+void OsInfoPage::UpdateMidiStatsScreen() {
+  // MIDI input: UART overruns, bytes dropped because the input buffer was
+  // full, and maximum number of bytes waiting in the input buffer.
+  char* buffer = display.line_buffer(0) + 1;
+  memcpy_P(&buffer[0], PSTR("midi in"), 7);
+  buffer[14] = kDelimiter;
+  memcpy_P(&buffer[15], PSTR("ovr"), 3);
+  PrintCount(&buffer[18], midi_dispatcher.input_overruns());
+  memcpy_P(&buffer[23], PSTR("drop"), 4);
+  PrintCount(&buffer[27], midi_dispatcher.input_dropped_bytes());
+  memcpy_P(&buffer[32], PSTR("max"), 3);
+  UnsafeItoa<int16_t>(midi_dispatcher.input_high_water_mark(), 3, &buffer[35]);
+  AlignRight(&buffer[35], 3);
+  
+  buffer = display.line_buffer(1) + 1;
+  strncpy_P(&buffer[25], PSTR("load|clr |exit"), 14);
+  buffer[29] = kDelimiter;
+  buffer[34] = kDelimiter;
+}
+
+/* static */
+void OsInfoPage::PrintDuration(char* buffer, uint32_t duration) {
+  // Durations are in us, and shown in ms above 10ms.
+  char unit = 'u';
+  if (duration > 9999) {
+    duration /= 1000;
+    unit = 'm';
+  }
+  PrintCount(buffer, duration > 9999 ? 9999 : duration);
+  buffer[4] = unit;
+}
+
+/* static */
+void OsInfoPage::UpdateLoadScreen() {
+  // Duration of the interrupts and of the tasks of the main loop. The encoder
+  // selects the task.
+  uint8_t channel = profiler_channel_;
+  char* buffer = display.line_buffer(0) + 1;
+  memcpy_P(&buffer[0], &profiler_channel_names[channel << 3], 8);
+  buffer[14] = kDelimiter;
+  memcpy_P(&buffer[15], PSTR("avg"), 3);
+  PrintDuration(&buffer[19], profiler.average_duration(channel));
+  memcpy_P(&buffer[25], PSTR("max"), 3);
+  PrintDuration(&buffer[29], profiler.max_duration(channel));
+  
+  buffer = display.line_buffer(1) + 1;
+  if (channel <= PROFILER_TIMER2_ISR) {
+    memcpy_P(&buffer[0], PSTR("cpu"), 3);
+    UnsafeItoa<int16_t>(profiler.load(channel), 3, &buffer[4]);
+    AlignRight(&buffer[4], 3);
+    buffer[7] = '%';
+  }
+  buffer[14] = kDelimiter;
+  memcpy_P(&buffer[15], PSTR("min"), 3);
+  PrintDuration(&buffer[19], profiler.min_duration(channel));
+  strncpy_P(&buffer[25], PSTR("tx  |clr |exit"), 14);
+  buffer[29] = kDelimiter;
+  buffer[34] = kDelimiter;
+}
+
+/* static */
+void OsInfoPage::UpdateVoicecardTxScreen() {
+  // Estimated delay between the moment a command is queued for the
+  // voicecards and the moment it is sent, for each class of commands. The
+  // encoder selects the class. Below, the number of data writes sent, and
+  // skipped because the voicecards already had the value.
+  uint8_t priority = tx_priority_;
+  char* buffer = display.line_buffer(0) + 1;
+  memcpy_P(
+      &buffer[0],
+      &tx_priority_names[(priority - TX_PRIORITY_REALTIME) << 3],
+      8);
+  buffer[14] = kDelimiter;
+  // One tick of the transmission interrupt lasts 25.5us.
+  memcpy_P(&buffer[15], PSTR("avg"), 3);
+  PrintDuration(
+      &buffer[19],
+      voicecard_tx.average_queueing_delay(priority) * kSampleRateDen /
+          (kSampleRateNum / 1000000));
+  memcpy_P(&buffer[25], PSTR("max"), 3);
+  PrintDuration(
+      &buffer[29],
+      voicecard_tx.max_queueing_delay(priority) * kSampleRateDen /
+          (kSampleRateNum / 1000000));
+  
+  buffer = display.line_buffer(1) + 1;
+  memcpy_P(&buffer[0], PSTR("sent"), 4);
+  PrintCount(&buffer[5], voicecard_tx.num_sent_writes());
+  buffer[14] = kDelimiter;
+  memcpy_P(&buffer[15], PSTR("skip"), 4);
+  PrintCount(&buffer[20], voicecard_tx.num_suppressed_writes());
+  strncpy_P(&buffer[25], PSTR("card|clr |exit"), 14);
+  buffer[29] = kDelimiter;
+  buffer[34] = kDelimiter;
+}
+
+/* static */
+void OsInfoPage::UpdateCardStatsScreen() {
+  // Voicecard health: audio buffer underruns, longest rendering of an audio
+  // block relative to the block duration, commands processed, and use of the
+  // SPI input buffer. The encoder selects the port.
+  if (active_control_ >= kNumVoices) {
+    active_control_ = kNumVoices - 1;
+  }
+  char* buffer = display.line_buffer(0) + 1;
+  memcpy_P(&buffer[0], PSTR("card"), 4);
+  buffer[5] = '1' + active_control_;
+  buffer[14] = kDelimiter;
+  
+  VoicecardStats stats;
+  uint8_t valid = voicecard_tx.GetStats(active_control_, &stats);
+  if (valid) {
+    memcpy_P(&buffer[15], PSTR("xrun"), 4);
+    PrintCount(&buffer[19], stats.num_underruns);
+    memcpy_P(&buffer[24], PSTR("cpu"), 3);
+    uint16_t load = U16(stats.max_block_duration) * 100 / stats.block_size;
+    UnsafeItoa<int16_t>(load > 999 ? 999 : load, 3, &buffer[27]);
+    AlignRight(&buffer[27], 3);
+    buffer[30] = '%';
+    memcpy_P(&buffer[32], PSTR("cmd"), 3);
+    PrintCount(&buffer[35], stats.num_commands);
+  } else {
+    memcpy_P(&buffer[15], PSTR("no stats"), 8);
+  }
+  
+  buffer = display.line_buffer(1) + 1;
+  if (valid) {
+    memcpy_P(&buffer[0], PSTR("rx"), 2);
+    UnsafeItoa<int16_t>(stats.rx_high_water_mark, 3, &buffer[3]);
+    AlignRight(&buffer[3], 3);
+    memcpy_P(&buffer[7], PSTR("ovr"), 3);
+    UnsafeItoa<int16_t>(stats.rx_overflows, 3, &buffer[10]);
+    AlignRight(&buffer[10], 3);
+  }
+  buffer[14] = kDelimiter;
+  strncpy_P(&buffer[25], PSTR("back|clr |exit"), 14);
+  buffer[29] = kDelimiter;
+  buffer[34] = kDelimiter;
+}
+
 /* static */
 void OsInfoPage::UpdateScreen() {
+  if (view_ == OS_INFO_VIEW_MIDI_STATS) {
+    UpdateMidiStatsScreen();
+    return;
+  } else if (view_ == OS_INFO_VIEW_LOAD) {
+    UpdateLoadScreen();
+    return;
+  } else if (view_ == OS_INFO_VIEW_VOICECARD_TX) {
+    UpdateVoicecardTxScreen();
+    return;
+  } else if (view_ == OS_INFO_VIEW_CARD_STATS) {
+    UpdateCardStatsScreen();
+    return;
+  }
   char* buffer = display.line_buffer(0) + 1;
   memcpy_P(&buffer[0], PSTR("ambika"), 6);
   PrintVersionNumber(&buffer[10], kSystemVersion);
@@ -141,12 +370,18 @@ void OsInfoPage::UpdateScreen() {
       strncpy_P(&buffer[15], PSTR("install"), 7);
     }
   }
+  strncpy_P(&buffer[25], PSTR("midi"), 4);
   strncpy_P(&buffer[35], PSTR("exit"), 4);
 }
 
 /* static */
 void OsInfoPage::UpdateLeds() {
   leds.set_pixel(LED_8, 0xf0);
+  leds.set_pixel(LED_6, 0x0f);
+  if (view_ != OS_INFO_VIEW_VERSIONS) {
+    leds.set_pixel(LED_7, 0x0f);
+    return;
+  }
   if (byteAnd(found_firmware_files_, 1)) {
     leds.set_pixel(LED_1, 0x0f);
   }
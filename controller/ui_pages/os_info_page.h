@@ -24,6 +24,15 @@
 
 namespace ambika {
 
+enum OsInfoView {
+  OS_INFO_VIEW_VERSIONS,
+  OS_INFO_VIEW_MIDI_STATS,
+  OS_INFO_VIEW_LOAD,
+  OS_INFO_VIEW_VOICECARD_TX,
+  OS_INFO_VIEW_CARD_STATS,
+  OS_INFO_VIEW_LAST
+};
+
 class OsInfoPage : public UiPage {
  public:
   OsInfoPage() = default;
@@ -52,12 +61,21 @@ class OsInfoPage : public UiPage {
 
 private:
   static void PrintVersionNumber(char* buffer, uint8_t number);
+  static void PrintCount(char* buffer, uint16_t count);
+  static void PrintDuration(char* buffer, uint32_t duration);
+  static void UpdateMidiStatsScreen();
+  static void UpdateLoadScreen();
+  static void UpdateVoicecardTxScreen();
+  static void UpdateCardStatsScreen();
   //static void ReadVoicecardVersion();
   static void FindFirmwareFiles();
   
   //static uint8_t voicecard_version_;
   //static uint8_t active_port_;
   static uint8_t found_firmware_files_;
+  static uint8_t view_;
+  static uint8_t profiler_channel_;
+  static uint8_t tx_priority_;
   
   DISALLOW_COPY_AND_ASSIGN(OsInfoPage);
 };
@@ -146,7 +146,7 @@ uint8_t SequenceEditor::OnIncrement(int8_t increment) {
           int16_t value = part_data().step_value(index - 2, step);
           value += increment;
           if (value >= 0 && value <= 255) {
-            mutable_part_data().set_step_value(index - 2, step, value);
+            multi.part(ui.active_part()).SetStepValue(index - 2, step, value);
           }
         }
         break;
@@ -191,7 +191,7 @@ uint8_t SequenceEditor::OnPot(uint8_t index, uint8_t value) {
     case 2:
     case 3:
       step = actual_step(step, index - 2);
-      mutable_part_data().set_step_value(index - 2, step, value * 2);
+      multi.part(ui.active_part()).SetStepValue(index - 2, step, value * 2);
       break;
   }
   return 1;
@@ -13,6 +13,8 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <avr/interrupt.h>
+
 #include "avrlib/op.h"
 #include "avrlib/time.h"
 
@@ -29,9 +31,34 @@ VoicecardProtocolTx voicecard_tx;
 SpiMaster<SpiSS, MSB_FIRST, 8> VoicecardProtocolTx::spi_;
 AddressBus VoicecardProtocolTx::voicecard_address_;
 uint8_t VoicecardProtocolTx::voice_status_[kNumVoices];
-uint8_t VoicecardProtocolTx::sd_card_busy_;
+uint8_t VoicecardProtocolTx::shadow_[kNumVoices][kNumShadowSlots];
+uint16_t VoicecardProtocolTx::shadow_valid_[kNumVoices];
+uint16_t VoicecardProtocolTx::num_sent_writes_;
+uint16_t VoicecardProtocolTx::num_suppressed_writes_;
+volatile uint8_t VoicecardProtocolTx::dirty_slots_[kNumVoices];
+volatile uint8_t VoicecardProtocolTx::sd_card_busy_;
 RingBuffer<OddOutputBufferSpecs> VoicecardProtocolTx::odd_buffer_;
 RingBuffer<EvenOutputBufferSpecs> VoicecardProtocolTx::even_buffer_;
+RingBuffer<OddRealtimeBufferSpecs> VoicecardProtocolTx::odd_realtime_buffer_;
+RingBuffer<EvenRealtimeBufferSpecs> VoicecardProtocolTx::even_realtime_buffer_;
+uint8_t VoicecardProtocolTx::scheduling_;
+uint8_t VoicecardProtocolTx::scheduled_overflow_;
+uint16_t VoicecardProtocolTx::scheduled_[2][kScheduledQueueSize];
+volatile uint8_t VoicecardProtocolTx::scheduled_read_[2];
+volatile uint8_t VoicecardProtocolTx::scheduled_release_[2];
+volatile uint8_t VoicecardProtocolTx::scheduled_pending_[2];
+uint8_t VoicecardProtocolTx::scheduled_write_[2];
+uint8_t VoicecardProtocolTx::priority_[2];
+volatile uint8_t VoicecardProtocolTx::arguments_size_[2];
+uint8_t VoicecardProtocolTx::queued_arguments_size_[TX_PRIORITY_LAST][2];
+QueueingStats VoicecardProtocolTx::queueing_stats_[TX_PRIORITY_LAST];
+uint8_t VoicecardProtocolTx::queued_group_bytes_[TX_PRIORITY_LAST][2];
+volatile uint8_t VoicecardProtocolTx::sent_group_bytes_[TX_PRIORITY_LAST][2];
+volatile uint8_t VoicecardProtocolTx::pending_voice_mask_[2];
+uint8_t VoicecardProtocolTx::pending_data_[2];
+volatile uint8_t VoicecardProtocolTx::slot_size_[2];
+uint8_t VoicecardProtocolTx::slot_data_[2][3];
+uint8_t VoicecardProtocolTx::slot_voice_id_[2];
 /* </static> */
 
 /* static */
@@ -39,23 +66,54 @@ void VoicecardProtocolTx::Init() {
   voicecard_address_.set_mode(DIGITAL_OUTPUT);
   spi_.Init();
   memset(voice_status_, 0, sizeof(voice_status_));
+  memset(shadow_valid_, 0, sizeof(shadow_valid_));
+  slot_voice_id_[0] = 0;
+  slot_voice_id_[1] = 1;
+  ResetQueueingStats();
 }
 
 /* static */
-void VoicecardProtocolTx::PrepareForBlockWrite(uint8_t voice_id) {
-  Write(voice_id, COMMAND_BULK_SEND);
+void VoicecardProtocolTx::ResetQueueingStats() {
+  memset(queueing_stats_, 0, sizeof(queueing_stats_));
 }
 
 /* static */
-void VoicecardProtocolTx::WriteBlock(uint8_t voice_id, const uint8_t* data, uint8_t size) {
-  FlushBuffers();
-  voicecard_address_.Write(voice_id);
-  spi_.Write(size);
-  while (size) {
-    // Block until we can write more.
-    spi_.Write(*data++);
-    --size;
+uint8_t VoicecardProtocolTx::LoadSlot(uint8_t parity) {
+  if (sd_card_busy_) {
+    return 0;
+  }
+  // Round-robin between the voicecards of this parity.
+  uint8_t voice_id = slot_voice_id_[parity];
+  for (uint8_t i = 0; i < kNumVoices / 2; ++i) {
+    voice_id += 2;
+    if (voice_id >= kNumVoices) {
+      voice_id = parity;
+    }
+    uint8_t dirty = dirty_slots_[voice_id];
+    if (!dirty) {
+      continue;
+    }
+    uint8_t slot = 0;
+    while (!(dirty & 1)) {
+      dirty >>= 1;
+      ++slot;
+    }
+    dirty_slots_[voice_id] &= ~(1 << slot);
+    
+    uint8_t* data = slot_data_[parity];
+    data[0] = shadow_[voice_id][slot];
+    if (slot < kFirstControllerShadowSlot) {
+      data[1] = byteOr(COMMAND_WRITE_LFO, slot);
+      slot_size_[parity] = 2;
+    } else {
+      data[1] = MOD_SRC_AFTERTOUCH + slot - kFirstControllerShadowSlot;
+      data[2] = COMMAND_WRITE_MOD_MATRIX;
+      slot_size_[parity] = 3;
+    }
+    slot_voice_id_[parity] = voice_id;
+    return 1;
   }
+  return 0;
 }
 
 /* static */
@@ -82,14 +140,17 @@ void VoicecardProtocolTx::Sync(uint8_t voice_id) {
 /* static */
 void VoicecardProtocolTx::Trigger(uint8_t voice_id, uint16_t note, uint8_t velocity, uint8_t legato) {
   voice_status_[voice_id] = velocity;
-  Write(voice_id, COMMAND_NOTE_ON + legato);
-  Write(voice_id, note >> 8u);
-  Write(voice_id, note & 0xffu);
-  Write(voice_id, velocity << 1u);
+  WriteRealtime(voice_id, COMMAND_NOTE_ON + legato);
+  WriteRealtime(voice_id, note >> 8u);
+  WriteRealtime(voice_id, note & 0xffu);
+  WriteRealtime(voice_id, velocity << 1u);
 }
 
 /* static */
 void VoicecardProtocolTx::WriteData(uint8_t voice_id, uint8_t data_type, uint8_t address, uint8_t value) {
+  if (!ShadowWrite(voice_id, ShadowSlot(data_type, address), value)) {
+    return;
+  }
   Write(voice_id, data_type);
   Write(voice_id, address);
   Write(voice_id, value);
@@ -97,10 +158,116 @@ void VoicecardProtocolTx::WriteData(uint8_t voice_id, uint8_t data_type, uint8_t
     
 /* static */
 void VoicecardProtocolTx::WriteLfo(uint8_t voice_id, uint8_t address, uint8_t value) {
+  uint8_t slot = ShadowSlot(VOICECARD_DATA_MODULATION, MOD_SRC_LFO_1 + address);
+  if (!ShadowWrite(voice_id, slot, value)) {
+    return;
+  }
   Write(voice_id, byteOr(COMMAND_WRITE_LFO, address));
   Write(voice_id, value);
 }
 
+/* static */
+void VoicecardProtocolTx::BroadcastData(
+    uint8_t voice_mask,
+    uint8_t data_type,
+    uint8_t address,
+    uint8_t value) {
+  voice_mask = ShadowWrite(voice_mask, data_type, address, value);
+  if (!voice_mask) {
+    return;
+  }
+  Broadcast(voice_mask, data_type);
+  Broadcast(voice_mask, address);
+  Broadcast(voice_mask, value);
+}
+
+/* static */
+void VoicecardProtocolTx::BroadcastLfo(uint8_t voice_mask, uint8_t address, uint8_t value) {
+  voice_mask = ShadowWrite(
+      voice_mask,
+      VOICECARD_DATA_MODULATION,
+      MOD_SRC_LFO_1 + address,
+      value);
+  if (!voice_mask) {
+    return;
+  }
+  Broadcast(voice_mask, byteOr(COMMAND_WRITE_LFO, address));
+  Broadcast(voice_mask, value);
+}
+
+/* static */
+void VoicecardProtocolTx::BroadcastRetriggerEnvelope(uint8_t voice_mask, uint8_t envelope_id) {
+  BroadcastRealtime(voice_mask, COMMAND_RETRIGGER_ENVELOPE | envelope_id);
+}
+
+/* static */
+void VoicecardProtocolTx::BroadcastStep(uint8_t voice_mask, uint8_t flags, const uint8_t* steps) {
+  BroadcastRealtime(voice_mask, byteOr(COMMAND_STEP, flags));
+  BroadcastRealtime(voice_mask, steps[0]);
+  BroadcastRealtime(voice_mask, steps[1]);
+}
+
+/* static */
+void VoicecardProtocolTx::BroadcastPatchChunk(
+    uint8_t voice_mask,
+    uint8_t index,
+    const uint8_t* data) {
+  Broadcast(voice_mask, byteOr(COMMAND_WRITE_PATCH_CHUNK, index));
+  for (uint8_t i = 0; i < kPatchChunkSize; ++i) {
+    Broadcast(voice_mask, data[i]);
+  }
+}
+
+/* static */
+void VoicecardProtocolTx::BroadcastCommitPatch(uint8_t voice_mask) {
+  Broadcast(voice_mask, COMMAND_COMMIT_PATCH);
+}
+
+/* static */
+void VoicecardProtocolTx::BroadcastRange(
+    uint8_t voice_mask,
+    uint8_t data_type,
+    uint8_t address,
+    const uint8_t* data,
+    uint8_t size) {
+  uint8_t command = COMMAND_WRITE_SEQUENCE_RANGE;
+  if (data_type == VOICECARD_DATA_PATCH) {
+    command = COMMAND_WRITE_PATCH_RANGE;
+  } else if (data_type == VOICECARD_DATA_PART) {
+    command = COMMAND_WRITE_PART_RANGE;
+  }
+  while (size) {
+    uint8_t count = size < kMaxRangeSize ? size : kMaxRangeSize;
+    // Skip the voicecards which already hold all the bytes of this range.
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < count; ++i) {
+      mask |= ShadowWrite(voice_mask, data_type, address + i, data[i]);
+    }
+    if (mask) {
+      Broadcast(mask, byteOr(command, count - 1));
+      Broadcast(mask, address);
+      for (uint8_t i = 0; i < count; ++i) {
+        Broadcast(mask, data[i]);
+      }
+    }
+    address += count;
+    data += count;
+    size -= count;
+  }
+}
+
+/* static */
+uint8_t VoicecardProtocolTx::writable(uint8_t voice_mask) {
+  uint8_t writable = 0xff;
+  if (voice_mask & kEvenVoicesMask) {
+    writable = even_buffer_.writable();
+  }
+  if ((voice_mask & kOddVoicesMask) && odd_buffer_.writable() < writable) {
+    writable = odd_buffer_.writable();
+  }
+  return writable;
+}
+
 /* static */
 Word VoicecardProtocolTx::GetVersion(uint8_t voice_id) {
   Word result;
@@ -114,6 +281,23 @@ Word VoicecardProtocolTx::GetVersion(uint8_t voice_id) {
   return result;
 }
 
+/* static */
+uint8_t VoicecardProtocolTx::GetStats(uint8_t voice_id, VoicecardStats* stats) {
+  auto data = reinterpret_cast<uint8_t*>(stats);
+  Sync(voice_id);
+  BlockingTransaction(voice_id, COMMAND_GET_STATS);
+  // Each transaction clocks out the byte prepared by the voicecard after the
+  // previous one.
+  for (uint8_t i = 0; i < kVoicecardStatsSize; ++i) {
+    ConstantDelay(2);
+    data[i] = BlockingTransaction(
+        voice_id,
+        i == kVoicecardStatsSize - 1 ? 0xff : COMMAND_GET_NEXT_STATS_BYTE);
+  }
+  // Older firmwares do not know the command and answer 0xff.
+  return stats->block_size != 0xff && stats->block_size != 0;
+}
+
 /* static */
 uint8_t VoicecardProtocolTx::WriteAsNibbles(uint8_t voice_id, uint8_t value) {
   voicecard_address_.Write(voice_id);
@@ -124,7 +308,20 @@ uint8_t VoicecardProtocolTx::WriteAsNibbles(uint8_t voice_id, uint8_t value) {
 
 /* static */
 void VoicecardProtocolTx::FlushBuffers() {
-  while (even_buffer_.readable() || odd_buffer_.readable());
+  // Scheduled commands are sent right away.
+  ReleaseScheduled();
+  uint8_t busy;
+  do {
+    busy = scheduled_read_[0] != scheduled_release_[0] ||
+        scheduled_read_[1] != scheduled_release_[1] ||
+        even_buffer_.readable() || odd_buffer_.readable() ||
+        even_realtime_buffer_.readable() || odd_realtime_buffer_.readable() ||
+        pending_voice_mask_[0] || pending_voice_mask_[1] ||
+        slot_size_[0] || slot_size_[1];
+    for (uint8_t i = 0; i < kNumVoices; ++i) {
+      busy |= dirty_slots_[i];
+    }
+  } while (busy);
 }
 
 /* static */
@@ -138,14 +335,227 @@ uint8_t VoicecardProtocolTx::BlockingTransaction(uint8_t voice_id, uint8_t value
 
 /* static */
 void VoicecardProtocolTx::Write(uint8_t voice_id, uint8_t value) {
+  Enqueue(TX_PRIORITY_BULK, voice_id & 1u, voice_id, value);
+}
+
+/* static */
+void VoicecardProtocolTx::WriteRealtime(uint8_t voice_id, uint8_t value) {
+  Enqueue(TX_PRIORITY_REALTIME, voice_id & 1u, voice_id, value);
+}
+
+/* static */
+void VoicecardProtocolTx::Broadcast(uint8_t voice_mask, uint8_t value) {
+  if (voice_mask & kEvenVoicesMask) {
+    Enqueue(TX_PRIORITY_BULK, 0, kVoiceMaskFlag | (voice_mask & kEvenVoicesMask), value);
+  }
+  if (voice_mask & kOddVoicesMask) {
+    Enqueue(TX_PRIORITY_BULK, 1, kVoiceMaskFlag | (voice_mask & kOddVoicesMask), value);
+  }
+}
+
+/* static */
+void VoicecardProtocolTx::BroadcastRealtime(uint8_t voice_mask, uint8_t value) {
+  if (voice_mask & kEvenVoicesMask) {
+    Enqueue(TX_PRIORITY_REALTIME, 0, kVoiceMaskFlag | (voice_mask & kEvenVoicesMask), value);
+  }
+  if (voice_mask & kOddVoicesMask) {
+    Enqueue(TX_PRIORITY_REALTIME, 1, kVoiceMaskFlag | (voice_mask & kOddVoicesMask), value);
+  }
+}
+
+/* static */
+void VoicecardProtocolTx::Enqueue(
+    uint8_t priority,
+    uint8_t parity,
+    uint8_t address,
+    uint8_t value) {
+  if (priority == TX_PRIORITY_REALTIME && scheduling_) {
+    priority = TX_PRIORITY_SCHEDULED;
+  }
+  uint8_t* arguments_size = &queued_arguments_size_[priority][parity];
+  if (*arguments_size) {
+    --*arguments_size;
+  } else {
+    *arguments_size = CommandArgumentsSize(value);
+    // Scheduled commands are delayed on purpose.
+    if (priority != TX_PRIORITY_SCHEDULED) {
+      RecordQueueingDelay(priority, parity);
+    }
+  }
+  
+  if (address & kVoiceMaskFlag) {
+    // All voicecards of the group but the lowest one.
+    uint8_t mask = address & ~kVoiceMaskFlag;
+    while (mask &= mask - 1) {
+      ++queued_group_bytes_[priority][parity];
+    }
+  }
+  
   Word w;
-  w.bytes[0] = voice_id;
+  w.bytes[0] = address;
   w.bytes[1] = value;
-  if (voice_id & 1u) {
-    odd_buffer_.Write(w.value);
+  if (priority == TX_PRIORITY_SCHEDULED) {
+    Schedule(parity, w.value);
+  } else if (priority == TX_PRIORITY_REALTIME) {
+    if (parity) {
+      odd_realtime_buffer_.Write(w.value);
+    } else {
+      even_realtime_buffer_.Write(w.value);
+    }
   } else {
-    even_buffer_.Write(w.value);
+    if (parity) {
+      odd_buffer_.Write(w.value);
+    } else {
+      even_buffer_.Write(w.value);
+    }
+  }
+}
+
+/* static */
+void VoicecardProtocolTx::Schedule(uint8_t parity, uint16_t value) {
+  uint8_t write = scheduled_write_[parity];
+  uint8_t next = (write + 1) & (kScheduledQueueSize - 1);
+  if (next == scheduled_read_[parity]) {
+    // The queue is full. Give up on the timing of this tick, and let the
+    // interrupt send what has been written so far to make room.
+    scheduled_overflow_ = 1;
+    scheduled_pending_[parity] = write;
+    scheduled_release_[parity] = write;
+    while (next == scheduled_read_[parity]);
+  }
+  scheduled_[parity][write] = value;
+  scheduled_write_[parity] = next;
+  if (scheduled_overflow_) {
+    scheduled_pending_[parity] = next;
+    scheduled_release_[parity] = next;
+  }
+}
+
+/* static */
+void VoicecardProtocolTx::RemoveScheduled(
+    uint8_t voice_mask,
+    uint8_t remove_groups) {
+  // While the next tick is being computed, the commands sent now are queued
+  // after the scheduled ones, in the right order.
+  if (scheduling_) {
+    return;
+  }
+  // The clock interrupt must not release the commands while the queue is
+  // being compacted.
+  uint8_t sreg = SREG;
+  cli();
+  for (uint8_t parity = 0; parity < 2; ++parity) {
+    uint8_t read = scheduled_release_[parity];
+    uint8_t write = read;
+    uint8_t pending = scheduled_pending_[parity];
+    uint8_t compacted_pending = read;
+    // The bytes of a command all go to the same voicecards, so whole commands
+    // are removed.
+    while (read != scheduled_write_[parity]) {
+      Word w;
+      w.value = scheduled_[parity][read];
+      uint8_t mask;
+      if (w.bytes[0] & kVoiceMaskFlag) {
+        mask = remove_groups ? w.bytes[0] & ~kVoiceMaskFlag : 0;
+      } else {
+        mask = 1 << w.bytes[0];
+      }
+      if (!(mask & voice_mask)) {
+        scheduled_[parity][write] = w.value;
+        write = (write + 1) & (kScheduledQueueSize - 1);
+      }
+      read = (read + 1) & (kScheduledQueueSize - 1);
+      if (read == pending) {
+        compacted_pending = write;
+      }
+    }
+    scheduled_pending_[parity] = compacted_pending;
+    scheduled_write_[parity] = write;
+  }
+  SREG = sreg;
+}
+
+/* static */
+void VoicecardProtocolTx::RecordQueueingDelay(uint8_t priority, uint8_t parity) {
+  // Estimate the delay from the number of bytes which will be sent first: one
+  // per queued entry, plus one per additional voicecard of the groups. Each
+  // parity is serviced every other tick.
+  uint8_t backlog = parity
+      ? odd_realtime_buffer_.readable()
+      : even_realtime_buffer_.readable();
+  backlog += pending_group_bytes(TX_PRIORITY_REALTIME, parity);
+  if (priority == TX_PRIORITY_BULK) {
+    backlog += parity ? odd_buffer_.readable() : even_buffer_.readable();
+    backlog += pending_group_bytes(TX_PRIORITY_BULK, parity);
+  }
+  uint8_t delay = backlog << 1;
+  QueueingStats* stats = &queueing_stats_[priority];
+  if (delay > stats->max_delay) {
+    stats->max_delay = delay;
+  }
+  stats->average_delay += delay - (stats->average_delay >> 4);
+}
+
+/* static */
+uint8_t VoicecardProtocolTx::ShadowSlot(uint8_t data_type, uint8_t address) {
+  if (data_type == VOICECARD_DATA_MODULATION) {
+    if (address >= MOD_SRC_LFO_1 && address <= MOD_SRC_LFO_3) {
+      return address - MOD_SRC_LFO_1;
+    } else if (address >= MOD_SRC_AFTERTOUCH && address <= MOD_SRC_EXPRESSION) {
+      return address - MOD_SRC_AFTERTOUCH + kFirstControllerShadowSlot;
+    }
+  } else if (data_type == VOICECARD_DATA_PART) {
+    if (address < kNumShadowedPartBytes) {
+      return address + kNumShadowedModSources;
+    }
+  }
+  return 0xff;
+}
+
+/* static */
+uint8_t VoicecardProtocolTx::ShadowWrite(
+    uint8_t voice_id,
+    uint8_t slot,
+    uint8_t value) {
+  if (slot != 0xff) {
+    uint16_t bit = 1 << slot;
+    if ((shadow_valid_[voice_id] & bit) && shadow_[voice_id][slot] == value) {
+      ++num_suppressed_writes_;
+      return 0;
+    }
+    shadow_valid_[voice_id] |= bit;
+    shadow_[voice_id][slot] = value;
+    if (slot < kNumShadowedModSources) {
+      // The value will be sent by SendBytes(). If the previous value had not
+      // been sent yet, it is simply replaced.
+      if (dirty_slots_[voice_id] & bit) {
+        ++num_suppressed_writes_;
+      } else {
+        dirty_slots_[voice_id] |= bit;
+        ++num_sent_writes_;
+      }
+      return 0;
+    }
+  }
+  ++num_sent_writes_;
+  return 1;
+}
+
+/* static */
+uint8_t VoicecardProtocolTx::ShadowWrite(
+    uint8_t voice_mask,
+    uint8_t data_type,
+    uint8_t address,
+    uint8_t value) {
+  uint8_t slot = ShadowSlot(data_type, address);
+  uint8_t mask = 1;
+  for (uint8_t i = 0; i < kNumVoices; ++i) {
+    if ((voice_mask & mask) && !ShadowWrite(i, slot, value)) {
+      voice_mask &= ~mask;
+    }
+    mask <<= 1;
   }
+  return voice_mask;
 }
 
 }  // namespace ambika
@@ -21,10 +21,12 @@
 #include "avrlib/parallel_io.h"
 #include "avrlib/spi.h"
 
+#include "common/patch.h"
 #include "common/protocol.h"
 
 #include "controller/controller.h"
 #include "controller/hardware_config.h"
+#include "controller/profiler.h"
 
 namespace ambika {
   
@@ -34,6 +36,47 @@ enum VoicecardDataType {
   VOICECARD_DATA_PATCH = COMMAND_WRITE_PATCH_DATA,
   VOICECARD_DATA_PART = COMMAND_WRITE_PART_DATA,
   VOICECARD_DATA_MODULATION = COMMAND_WRITE_MOD_MATRIX,
+  VOICECARD_DATA_SEQUENCE = COMMAND_WRITE_SEQUENCE_DATA,
+};
+
+// Entries of the output buffers are (address, byte) pairs. When the MSB of the
+// address is set, the 7 lowest bits are a mask of voicecards (all of the same
+// parity as the buffer) which will all receive the byte, one after the other.
+// This way, a command sent to all the voicecards of a part is queued only once
+// per buffer.
+static const uint8_t kVoiceMaskFlag = 0x80;
+static const uint8_t kEvenVoicesMask = 0x15;
+static const uint8_t kOddVoicesMask = 0x2a;
+
+// The controller keeps a copy of the last values written to each voicecard
+// for the modulation sources it controls (LFO 1-3, aftertouch, pitch-bend,
+// wheels, expression) and for the part settings mirrored by the voicecard.
+// Writes which would not change anything on the voicecard are dropped.
+//
+// Modulation source writes are not queued: they only update the shadow copy
+// and mark the slot as dirty. Dirty slots are sent by SendBytes() when there
+// is nothing else to send, so a new value replaces an older one which has not
+// been sent yet, and notes never wait behind obsolete modulation values.
+static const uint8_t kNumShadowedModSources = 8;
+static const uint8_t kNumShadowedPartBytes = 7;
+static const uint8_t kNumShadowSlots = kNumShadowedModSources + kNumShadowedPartBytes;
+static const uint8_t kFirstControllerShadowSlot = kNumLfos;
+// Slots reset by COMMAND_RESET_ALL_CONTROLLERS.
+static const uint16_t kControllersShadowSlots = 0x00f8;
+
+// Notes and envelope/sequencer triggers are queued in a separate buffer, which
+// is sent first. Commands are never interleaved: the other buffer is only
+// considered once the last byte of the command in progress has been sent.
+//
+// When the internal clock runs, the notes and steps of the sequencer and
+// arpeggiator are computed one clock tick ahead, and held in a scheduled
+// queue. The clock interrupt releases them when the tick is due, and they
+// are then sent before everything else.
+enum TxPriority : uint8_t {
+  TX_PRIORITY_SCHEDULED,
+  TX_PRIORITY_REALTIME,
+  TX_PRIORITY_BULK,
+  TX_PRIORITY_LAST
 };
 
 struct OddOutputBufferSpecs {
@@ -52,6 +95,35 @@ struct EvenOutputBufferSpecs {
   };
 };
 
+struct OddRealtimeBufferSpecs {
+  typedef uint16_t Value;
+  enum {
+    buffer_size = 16,
+    data_size = 16,
+  };
+};
+
+struct EvenRealtimeBufferSpecs {
+  typedef uint16_t Value;
+  enum {
+    buffer_size = 16,
+    data_size = 16,
+  };
+};
+
+// Each part queues for a tick a step command (3 words), and for each note a
+// trigger (4 words) and a release (1 word). This leaves room for 6 parts on
+// the same voicecards. Must be a power of 2.
+static const uint8_t kScheduledQueueSize = 64;
+
+struct QueueingStats {
+  // Estimated delay between the moment a command is queued and the moment it
+  // is sent, in ticks of the voicecard transmission interrupt.
+  uint8_t max_delay;
+  // Running average, scaled by 16.
+  uint16_t average_delay;
+};
+
 class VoicecardProtocolTx {
  public:
   VoicecardProtocolTx() = default;
@@ -63,37 +135,71 @@ class VoicecardProtocolTx {
 
   static void WriteLfo(uint8_t voice_id, uint8_t address, uint8_t value);
 
+  // Send the same command to all the voicecards in voice_mask (bit n set for
+  // voicecard n).
+  static void BroadcastData(
+      uint8_t voice_mask,
+      uint8_t data_type,
+      uint8_t address,
+      uint8_t value);
+  static void BroadcastLfo(uint8_t voice_mask, uint8_t address, uint8_t value);
+  static void BroadcastRetriggerEnvelope(uint8_t voice_mask, uint8_t envelope_id);
+  static void BroadcastStep(uint8_t voice_mask, uint8_t flags, const uint8_t* steps);
+  static void BroadcastPatchChunk(
+      uint8_t voice_mask,
+      uint8_t index,
+      const uint8_t* data);
+  static void BroadcastCommitPatch(uint8_t voice_mask);
+  // Writes size consecutive bytes of patch, part or sequence data, using
+  // range commands of up to kMaxRangeSize bytes.
+  static void BroadcastRange(
+      uint8_t voice_mask,
+      uint8_t data_type,
+      uint8_t address,
+      const uint8_t* data,
+      uint8_t size);
+  
+  // Number of entries which can be queued without blocking.
+  static uint8_t writable(uint8_t voice_mask);
+
   static void Sync(uint8_t voice_id);
   static void SyncAllVoices();
   static void LightsOut();
 
-  static void PrepareForBlockWrite(uint8_t voice_id);
-  static void WriteBlock(uint8_t voice_id, const uint8_t* data, uint8_t size);
-
   static inline void Release(uint8_t voice_id) {
     voice_status_[voice_id] = 0;
-    Write(voice_id, COMMAND_RELEASE);
+    WriteRealtime(voice_id, COMMAND_RELEASE);
   }
   
   static inline void Kill(uint8_t voice_id) {
     voice_status_[voice_id] = 0;
-    Write(voice_id, COMMAND_KILL);
+    WriteRealtime(voice_id, COMMAND_KILL);
   }
   
   static inline void RetriggerEnvelope(uint8_t voice_id, uint8_t envelope_id) {
-    Write(voice_id, COMMAND_RETRIGGER_ENVELOPE | envelope_id);
+    WriteRealtime(voice_id, COMMAND_RETRIGGER_ENVELOPE | envelope_id);
   }
   
   static inline void ResetAllControllers(uint8_t voice_id) {
+    shadow_valid_[voice_id] &= ~kControllersShadowSlots;
+    dirty_slots_[voice_id] &= ~kControllersShadowSlots;
     Write(voice_id, COMMAND_RESET_ALL_CONTROLLERS);
   }
   
   static inline void Reset(uint8_t voice_id) {
     voice_status_[voice_id] = 0;
+    shadow_valid_[voice_id] = 0;
+    dirty_slots_[voice_id] = 0;
     Write(voice_id, COMMAND_RESET);
   }
   
   static Word GetVersion(uint8_t voice_id);
+  // Returns false if the voicecard did not answer with valid statistics.
+  static uint8_t GetStats(uint8_t voice_id, VoicecardStats* stats);
+  
+  static inline void ResetStats(uint8_t voice_id) {
+    Write(voice_id, COMMAND_RESET_STATS);
+  }
 
   static inline uint8_t voice_status(uint8_t voice_id) {
     return voice_status_[voice_id];
@@ -104,63 +210,281 @@ class VoicecardProtocolTx {
   }
   
   static inline uint8_t EnterFirmwareUpdateMode(uint8_t voice_id) {
+    shadow_valid_[voice_id] = 0;
     return BlockingTransaction(voice_id, COMMAND_FIRMWARE_UPDATE_MODE);
   }
   
+  // Statistics about the writes dropped because of the shadow state.
+  static inline uint16_t num_sent_writes() { return num_sent_writes_; }
+  static inline uint16_t num_suppressed_writes() {
+    return num_suppressed_writes_;
+  }
+  // Used by the parts, which keep track of the patch data themselves.
+  static inline void CountSuppressedWrites(uint8_t num_writes) {
+    num_suppressed_writes_ += num_writes;
+  }
+  static inline void ResetWriteCounts() {
+    num_sent_writes_ = 0;
+    num_suppressed_writes_ = 0;
+  }
+  
+  // Realtime writes made between BeginScheduled() and EndScheduled() are held
+  // in the scheduled queue until ReleaseScheduled() is called.
+  static inline void BeginScheduled() {
+    scheduling_ = 1;
+    scheduled_overflow_ = 0;
+  }
+  static inline uint8_t scheduling() { return scheduling_; }
+  static inline void EndScheduled() {
+    scheduling_ = 0;
+    scheduled_pending_[0] = scheduled_write_[0];
+    scheduled_pending_[1] = scheduled_write_[1];
+  }
+  // Called by the clock interrupt when the tick for which the scheduled
+  // commands have been computed is due.
+  static inline void ReleaseScheduled() {
+    scheduled_release_[0] = scheduled_pending_[0];
+    scheduled_release_[1] = scheduled_pending_[1];
+  }
+  // Removes the commands for the voicecards of voice_mask which have not
+  // been released yet. Used by the parts when they release or kill their
+  // voices, so that a note computed for the next tick does not follow.
+  static inline void CancelScheduled(uint8_t voice_mask) {
+    RemoveScheduled(voice_mask, 1);
+  }
+  // Same, but the commands sent to a group of voicecards, like the sequencer
+  // steps of a part, are kept. Used when only some voices of a part are
+  // released.
+  static inline void CancelScheduledNotes(uint8_t voice_mask) {
+    RemoveScheduled(voice_mask, 0);
+  }
+  
+  static inline uint8_t max_queueing_delay(uint8_t priority) {
+    return queueing_stats_[priority].max_delay;
+  }
+  static inline uint8_t average_queueing_delay(uint8_t priority) {
+    return queueing_stats_[priority].average_delay >> 4;
+  }
+  static void ResetQueueingStats();
+  
+  // SendBytes() leaves the bus alone while the SD card uses it. There is no
+  // need to wait for the buffers to be flushed: the voicecards simply receive
+  // the rest of the data when the SD card releases the bus.
   static inline void BeginSdCard() {
-    FlushBuffers();
+    profiler.Begin(PROFILER_STORAGE);
+    sd_card_busy_ = 1;
     voicecard_address_.Write(SPI_SLAVE_SD_CARD);
     SpiMISO::High();
     SPCR = 0x50;
     SPSR = 0x01;
-    sd_card_busy_ = 1;
   }
   
   static inline void EndSdCard() {
     SpiMISO::Low();
     spi_.Init();
     sd_card_busy_ = 0;
+    profiler.End(PROFILER_STORAGE);
   }
   
   static uint8_t WriteAsNibbles(uint8_t voice_id, uint8_t value);
   
-  // Wait until the odd and even buffer are empty. This can take up to 1ms.
+  // Wait until the odd and even buffer are empty, and all the modulation
+  // values have been sent. This can take a few ms.
   static void FlushBuffers();
   
   static inline void SendBytes() {
     static uint8_t flop;
-    flop ^= 1;
-    if (even_buffer_.readable() && flop) {
-      Word w;
-      w.value = even_buffer_.ImmediateRead();
-      voicecard_address_.Write(w.bytes[0]);
-      spi_.Write(w.bytes[1]);
+    if (sd_card_busy_) {
+      return;
     }
-    if (odd_buffer_.readable() && !flop) {
-      Word w;
-      w.value = odd_buffer_.ImmediateRead();
-      voicecard_address_.Write(w.bytes[0]);
-      // TODO(pichenettes): there's an optimization here... we do not need to
-      // wait for the end of the write and we can leave early. But then we
-      // might end up with a dangling SS set to low and we don't want that,
-      // hell no!
-      spi_.Write(w.bytes[1]);
+    flop ^= 1;
+    if (flop) {
+      SendByte(&even_realtime_buffer_, &even_buffer_, 0);
+    } else {
+      SendByte(&odd_realtime_buffer_, &odd_buffer_, 1);
     }
   }
   
  private:
+  template<typename RealtimeBuffer, typename Buffer>
+  static inline void SendByte(
+      RealtimeBuffer* realtime_buffer,
+      Buffer* buffer,
+      uint8_t parity) {
+    Word w;
+    if (pending_voice_mask_[parity]) {
+      // Continue the transmission of a byte to a group of voicecards.
+      w.bytes[1] = pending_data_[parity];
+      ++sent_group_bytes_[priority_[parity]][parity];
+    } else if (slot_size_[parity]) {
+      SendSlotByte(parity);
+      return;
+    } else {
+      uint8_t priority = priority_[parity];
+      if (!arguments_size_[parity]) {
+        // We are between two commands, pick the next one, by order of
+        // priority. Modulation values are sent only when there is nothing
+        // else to send.
+        if (scheduled_read_[parity] != scheduled_release_[parity]) {
+          priority = TX_PRIORITY_SCHEDULED;
+        } else if (realtime_buffer->readable()) {
+          priority = TX_PRIORITY_REALTIME;
+        } else if (buffer->readable()) {
+          priority = TX_PRIORITY_BULK;
+        } else {
+          if (LoadSlot(parity)) {
+            SendSlotByte(parity);
+          }
+          return;
+        }
+        priority_[parity] = priority;
+      }
+      // Otherwise, the command in progress has to be completed first - even if
+      // this means waiting for the rest of it to be queued.
+      if (priority == TX_PRIORITY_SCHEDULED) {
+        uint8_t read = scheduled_read_[parity];
+        if (read == scheduled_release_[parity]) {
+          return;
+        }
+        w.value = scheduled_[parity][read];
+        scheduled_read_[parity] = (read + 1) & (kScheduledQueueSize - 1);
+      } else if (priority == TX_PRIORITY_REALTIME) {
+        if (!realtime_buffer->readable()) {
+          return;
+        }
+        w.value = realtime_buffer->ImmediateRead();
+      } else {
+        if (!buffer->readable()) {
+          return;
+        }
+        w.value = buffer->ImmediateRead();
+      }
+      if (arguments_size_[parity]) {
+        --arguments_size_[parity];
+      } else {
+        arguments_size_[parity] = CommandArgumentsSize(w.bytes[1]);
+      }
+      if (!(w.bytes[0] & kVoiceMaskFlag)) {
+        Transmit(w.bytes[0], w.bytes[1]);
+        return;
+      }
+      pending_voice_mask_[parity] = w.bytes[0] & ~kVoiceMaskFlag;
+      pending_data_[parity] = w.bytes[1];
+    }
+    // Send the byte to the lowest voicecard of the group, and remove it from
+    // the group.
+    uint8_t voice_mask = pending_voice_mask_[parity];
+    uint8_t voice_id = 0;
+    while (!(voice_mask & 1)) {
+      voice_mask >>= 1;
+      ++voice_id;
+    }
+    pending_voice_mask_[parity] &= pending_voice_mask_[parity] - 1;
+    Transmit(voice_id, w.bytes[1]);
+  }
+  
+  static inline void SendSlotByte(uint8_t parity) {
+    uint8_t size = slot_size_[parity] - 1;
+    slot_size_[parity] = size;
+    Transmit(slot_voice_id_[parity], slot_data_[parity][size]);
+  }
+  
+  static inline void Transmit(uint8_t voice_id, uint8_t value) {
+    voicecard_address_.Write(voice_id);
+    // TODO(pichenettes): there's an optimization here... we do not need
+    // to wait for the end of the write and we can leave early. But then
+    // we might end up with a dangling SS set to low and we don't want
+    // that, hell no!
+    spi_.Write(value);
+  }
+  
+  // Prepare the transmission of a dirty modulation slot to a voicecard of the
+  // given parity. Returns 0 if there is nothing to send.
+  static uint8_t LoadSlot(uint8_t parity);
+
   // Flush the buffer and do a write/read transaction.
   static uint8_t BlockingTransaction(uint8_t voice_id, uint8_t value);
   static void Write(uint8_t voice_id, uint8_t value);
+  static void WriteRealtime(uint8_t voice_id, uint8_t value);
+  static void Broadcast(uint8_t voice_mask, uint8_t value);
+  static void BroadcastRealtime(uint8_t voice_mask, uint8_t value);
+  static void Enqueue(
+      uint8_t priority,
+      uint8_t parity,
+      uint8_t address,
+      uint8_t value);
+  static void RecordQueueingDelay(uint8_t priority, uint8_t parity);
+  static inline uint8_t pending_group_bytes(uint8_t priority, uint8_t parity) {
+    return queued_group_bytes_[priority][parity] -
+        sent_group_bytes_[priority][parity];
+  }
+  static void Schedule(uint8_t parity, uint16_t value);
+  static void RemoveScheduled(uint8_t voice_mask, uint8_t remove_groups);
+  
+  static uint8_t ShadowSlot(uint8_t data_type, uint8_t address);
+  // Record a write in the shadow state. Returns 0 if the voicecard already
+  // has this value.
+  static uint8_t ShadowWrite(uint8_t voice_id, uint8_t slot, uint8_t value);
+  // Returns the subset of voice_mask for which a write has to be sent.
+  static uint8_t ShadowWrite(
+      uint8_t voice_mask,
+      uint8_t data_type,
+      uint8_t address,
+      uint8_t value);
 
   static SpiMaster<SpiSS, MSB_FIRST, 8> spi_;
   static AddressBus voicecard_address_;
   
   static uint8_t voice_status_[kNumVoices];
-  static uint8_t sd_card_busy_;
+  
+  static uint8_t shadow_[kNumVoices][kNumShadowSlots];
+  static uint16_t shadow_valid_[kNumVoices];
+  static uint16_t num_sent_writes_;
+  static uint16_t num_suppressed_writes_;
+  static volatile uint8_t dirty_slots_[kNumVoices];
+  static volatile uint8_t sd_card_busy_;
   
   static RingBuffer<OddOutputBufferSpecs> odd_buffer_;
   static RingBuffer<EvenOutputBufferSpecs> even_buffer_;
+  static RingBuffer<OddRealtimeBufferSpecs> odd_realtime_buffer_;
+  static RingBuffer<EvenRealtimeBufferSpecs> even_realtime_buffer_;
+  
+  // Scheduled commands for the even (0) and odd (1) voicecards. Entries up to
+  // scheduled_release_ can be sent; entries up to scheduled_pending_ will be
+  // at the next clock tick; entries up to scheduled_write_ are still being
+  // written.
+  static uint8_t scheduling_;
+  static uint8_t scheduled_overflow_;
+  static uint16_t scheduled_[2][kScheduledQueueSize];
+  static volatile uint8_t scheduled_read_[2];
+  static volatile uint8_t scheduled_release_[2];
+  static volatile uint8_t scheduled_pending_[2];
+  static uint8_t scheduled_write_[2];
+  
+  // Priority of the command being sent to the even (0) and odd (1)
+  // voicecards, and number of bytes left to send.
+  static uint8_t priority_[2];
+  static volatile uint8_t arguments_size_[2];
+  
+  // Same, on the side of the main loop, used to detect when a new command is
+  // queued.
+  static uint8_t queued_arguments_size_[TX_PRIORITY_LAST][2];
+  static QueueingStats queueing_stats_[TX_PRIORITY_LAST];
+  // A byte queued for a group of voicecards is sent once per voicecard. The
+  // transmissions beyond the first are counted when queued by the main loop,
+  // and when sent by the interrupt - each counter has a single writer.
+  static uint8_t queued_group_bytes_[TX_PRIORITY_LAST][2];
+  static volatile uint8_t sent_group_bytes_[TX_PRIORITY_LAST][2];
+  
+  // Group transmission in progress for the even (0) and odd (1) voicecards.
+  static volatile uint8_t pending_voice_mask_[2];
+  static uint8_t pending_data_[2];
+  
+  // Modulation value transmission in progress for the even (0) and odd (1)
+  // voicecards. Bytes are stored in reverse order.
+  static volatile uint8_t slot_size_[2];
+  static uint8_t slot_data_[2][3];
+  static uint8_t slot_voice_id_[2];
   
   DISALLOW_COPY_AND_ASSIGN(VoicecardProtocolTx);
 };
@@ -24,6 +24,8 @@
 #include "voicecard/sub_oscillator.h"
 #include "voicecard/transient_generator.h"
 
+#include <string.h>
+
 using namespace avrlib;
 
 namespace ambika {
@@ -39,6 +41,7 @@ TransientGenerator transient_generator;
 /* <static> */
 
 Patch Voice::patch_object;
+Patch Voice::staging_patch_object;
 VoicePart Voice::part_object;
 
 Lfo Voice::voice_lfo;
@@ -48,6 +51,7 @@ int16_t Voice::pitch_increment;
 int16_t Voice::pitch_target;
 int16_t Voice::pitch_value;
 uint8_t Voice::mod_source_value[kNumModulationSources];
+uint8_t Voice::sequence_data[kSequenceDataSize];
 int8_t Voice::modulation_destinations[kNumModulationDestinations];
 int16_t Voice::dst[kNumModulationDestinations];
 uint8_t Voice::buffer[kAudioBlockSize];
@@ -141,6 +145,7 @@ void Voice::Init() {
   Patch::Parameters p;
   ResourcesManager::Load(&init_patch_params, 0, &p);
   patch() = Patch(p);
+  DiscardStagingPatch();
   ResetAllControllers();
   part().volume() = 127;
   part().portamento_time() = 0;
@@ -164,6 +169,28 @@ void Voice::ResetAllControllers() {
     mod_source_value[MOD_SRC_CONSTANT_256] = 255;
 }
 
+/* static */
+void Voice::WritePatchChunk(uint8_t index, const uint8_t* data) {
+  if (index < kNumPatchChunks) {
+    memcpy(staging_patch_object.bytes() + index * kPatchChunkSize, data, kPatchChunkSize);
+  }
+}
+
+/* static */
+void Voice::Step(uint8_t flags, uint8_t sequence_1_step, uint8_t sequence_2_step) {
+  if (flags & STEP_FLAG_SEQUENCE_1) {
+    mod_source_value[MOD_SRC_SEQ_1] = sequence_data[
+        sequence_1_step & (kSequenceDataSize - 1)];
+  }
+  if (flags & STEP_FLAG_SEQUENCE_2) {
+    // Same wrapping as PartData::step_value() on the controller, for sequences
+    // longer than 16 steps.
+    mod_source_value[MOD_SRC_SEQ_2] = sequence_data[
+        (sequence_2_step + 16) & (kSequenceDataSize - 1)];
+  }
+  mod_source_value[MOD_SRC_ARP_STEP] = flags & STEP_FLAG_ARPEGGIATOR_GATE ? 255 : 0;
+}
+
 /* static */
 void Voice::TriggerEnvelope(Envelope::Stage stage) {
   for (uint8_t i = 0; i < kNumEnvelopes; ++i) {
@@ -22,6 +22,7 @@
 
 #include "common/lfo.h"
 #include "common/patch.h"
+#include "common/protocol.h"
 
 #include "voicecard/envelope.h"
 
@@ -117,6 +118,28 @@ class Voice {
   }
   
 
+  static inline void set_sequence_data(uint8_t address, uint8_t value) {
+    sequence_data[address & (kSequenceDataSize - 1)] = value;
+  }
+  
+  // Called on each step of the controller's sequencer/arpeggiator clock. The
+  // step values are looked up locally rather than being sent by the
+  // controller.
+  static void Step(uint8_t flags, uint8_t sequence_1_step, uint8_t sequence_2_step);
+
+  // Patches are received by chunks in a staging area, and become active at
+  // once when the transfer is complete. Individual parameter writes are
+  // applied to both copies.
+  static inline void set_patch_data(uint8_t address, uint8_t value) {
+    patch_object.setData(address, value);
+    staging_patch_object.setData(address, value);
+  }
+  static void WritePatchChunk(uint8_t index, const uint8_t* data);
+  static inline void CommitPatch() { patch_object = staging_patch_object; }
+  static inline void DiscardStagingPatch() {
+    staging_patch_object = patch_object;
+  }
+
   static Patch& patch() { return patch_object; }
   static VoicePart& part() { return part_object; }
 
@@ -132,6 +155,7 @@ class Voice {
   static inline void RenderOscillators();
 
   static Patch patch_object;
+  static Patch staging_patch_object;
   static VoicePart part_object;
   
   // Envelope generators.
@@ -139,6 +163,7 @@ class Voice {
   static uint8_t gate;
   static Lfo voice_lfo;
   static uint8_t mod_source_value[kNumModulationSources];
+  static uint8_t sequence_data[kSequenceDataSize];
   static int8_t modulation_destinations[kNumModulationDestinations];
   static int16_t dst[kNumModulationDestinations];
 
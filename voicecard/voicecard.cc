@@ -87,6 +87,8 @@ ISR(TIMER2_OVF_vect) {
       dac_interface.Overwrite(highByte(sample_12bits));
       dac_interface.Overwrite(lowByte(sample_12bits));
     }
+  } else {
+    voicecard_rx.CountUnderrun();
   }
   voicecard_rx.Receive();
 
@@ -160,7 +162,8 @@ int main() {
 #ifdef TIMING_CODE
     interrupt_counter = 0;
 #endif
-    if (audio_buffer.spaceLeft() >= kAudioBlockSize) {
+    uint8_t space_left = audio_buffer.spaceLeft();
+    if (space_left >= kAudioBlockSize) {
       voicecard_rx.TickRxLed();
 #ifdef TIMING_CODE
       timing_signal1::high();
@@ -169,6 +172,9 @@ int main() {
 #else
       voice.ProcessBlock();
 #endif
+      // The samples played while the block was rendered.
+      voicecard_rx.RecordBlockDuration(
+          audio_buffer.spaceLeft() + kAudioBlockSize - space_left);
       vcf_cutoff_out.Write(voice.cutoff());
       vcf_resonance_out.Write(voice.resonance());
       vcf_mode.Write(filter_mode_bytes[voice.patch().filter(0).mode]);
@@ -36,11 +36,20 @@ uint8_t* VoicecardProtocolRx::data_ptr_;
 uint8_t VoicecardProtocolRx::rx_led_counter_;
 
 /* static */
-uint8_t VoicecardProtocolRx::arguments_[3];
+uint8_t VoicecardProtocolRx::arguments_[kMaxCommandArgumentsSize];
 
 /* static */
 uint8_t VoicecardProtocolRx::lights_out_;
 
+/* static */
+VoicecardStats VoicecardProtocolRx::stats_;
+
+/* static */
+uint8_t VoicecardProtocolRx::stats_snapshot_[kVoicecardStatsSize];
+
+/* static */
+uint8_t VoicecardProtocolRx::stats_snapshot_index_;
+
 /* extern */
 VoicecardProtocolRx voicecard_rx;
 
@@ -30,6 +30,8 @@
 #include "voicecard/leds.h"
 
 #include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <string.h>
 
 namespace ambika {
 
@@ -62,6 +64,9 @@ class VoicecardProtocolRx {
     if (spi_.readable()) {
       rx_led_counter_ = 255;
       uint8_t byte = spi_.ImmediateRead();
+      if (!buffer_.writable() && stats_.rx_overflows != 0xff) {
+        ++stats_.rx_overflows;
+      }
       buffer_.Overwrite(byte);
       spi_.Reply(0xff);
     }
@@ -95,7 +100,10 @@ class VoicecardProtocolRx {
         break;
       }
       case COMMAND_WRITE_PATCH_DATA:
-        voice.patch().setData(arguments_[0], arguments_[1]);
+        voice.set_patch_data(arguments_[0], arguments_[1]);
+        break;
+      case COMMAND_WRITE_PATCH_CHUNK:
+        voice.WritePatchChunk(lowNibble(command_), arguments_);
         break;
       case COMMAND_WRITE_PART_DATA:
         voice.part().setData(arguments_[0], arguments_[1]);
@@ -113,6 +121,33 @@ class VoicecardProtocolRx {
         voice.set_mod_source_value(lfo, arguments_[0]);
         break;
       }
+      case COMMAND_WRITE_SEQUENCE_DATA:
+        voice.set_sequence_data(arguments_[0], arguments_[1]);
+        break;
+      case COMMAND_STEP:
+        voice.Step(lowNibble(command_), arguments_[0], arguments_[1]);
+        break;
+      case COMMAND_WRITE_PATCH_RANGE:
+      case COMMAND_WRITE_PART_RANGE:
+      case COMMAND_WRITE_SEQUENCE_RANGE:
+        WriteRange(commandCode);
+        break;
+    }
+  }
+  
+  static void WriteRange(uint8_t command) {
+    uint8_t address = arguments_[0];
+    const uint8_t* data = &arguments_[1];
+    for (uint8_t count = lowNibble(command_) + 1; count; --count) {
+      if (command == COMMAND_WRITE_PATCH_RANGE) {
+        voice.set_patch_data(address, *data);
+      } else if (command == COMMAND_WRITE_PART_RANGE) {
+        voice.part().setData(address, *data);
+      } else {
+        voice.set_sequence_data(address, *data);
+      }
+      ++address;
+      ++data;
     }
   }
   
@@ -140,6 +175,11 @@ class VoicecardProtocolRx {
         voice.Init();
         NoteLed::low();
         break;
+      case COMMAND_COMMIT_PATCH:
+        // Commands are processed between two audio blocks, so the new patch
+        // is used from the beginning of the next block.
+        voice.CommitPatch();
+        break;
       case COMMAND_LIGHTS_OUT:
         lights_out_ = 1;
         RxLed::low();
@@ -155,6 +195,7 @@ class VoicecardProtocolRx {
           while (size--) {
             *data++ = spi_.Read();
           }
+          voice.DiscardStagingPatch();
           Timer<2>::Start();
         }
         break;
@@ -170,29 +211,49 @@ class VoicecardProtocolRx {
       case COMMAND_GET_VERSION_ID:  
         SPDR = kSystemVersion;
         break;
+      case COMMAND_GET_STATS:
+        // The underrun counter is updated by the audio interrupt.
+        cli();
+        stats_.block_size = kAudioBlockSize;
+        memcpy(stats_snapshot_, &stats_, kVoicecardStatsSize);
+        sei();
+        SPDR = stats_snapshot_[0];
+        stats_snapshot_index_ = 1;
+        break;
+      case COMMAND_GET_NEXT_STATS_BYTE:
+        if (stats_snapshot_index_ < kVoicecardStatsSize) {
+          SPDR = stats_snapshot_[stats_snapshot_index_++];
+        }
+        break;
+      case COMMAND_RESET_STATS:
+        cli();
+        memset(&stats_, 0, sizeof(stats_));
+        sei();
+        break;
     }
   }
   
   static void Process() {
+    uint8_t readable = buffer_.readable();
+    if (readable > stats_.rx_high_water_mark) {
+      stats_.rx_high_water_mark = readable;
+    }
     while (buffer_.readable()) {
       uint8_t byte = buffer_.ImmediateRead();
       if (state_ == EXPECTING_COMMAND) {
         command_ = byte;
         data_ptr_ = arguments_;
-        state_ = EXPECTING_ARGUMENTS;
-        if (command_ >= COMMAND_NOTE_ON && command_ < COMMAND_WRITE_PATCH_DATA) {
-          data_size_ = 3;
-        } else if (command_ >= COMMAND_WRITE_PATCH_DATA && command_ < COMMAND_WRITE_LFO) {
-          data_size_ = 2;
-        } else if (highNibbleUnshifted(command_) == COMMAND_WRITE_LFO) {
-          data_size_ = 1;
+        data_size_ = CommandArgumentsSize(command_);
+        if (data_size_) {
+          state_ = EXPECTING_ARGUMENTS;
         } else {
+          ++stats_.num_commands;
           DoShortCommand();
-          state_ = EXPECTING_COMMAND;
         }
       } else {
         *data_ptr_++ = byte;
         if (--data_size_ == 0) {
+          ++stats_.num_commands;
           DoLongCommand();
           state_ = EXPECTING_COMMAND;
         }
@@ -201,6 +262,19 @@ class VoicecardProtocolRx {
   }
   
   static inline uint8_t writable() { return buffer_.writable(); }
+  
+  // Called by the audio interrupt when there is no sample to play.
+  static inline void CountUnderrun() {
+    if (stats_.num_underruns != 0xffff) {
+      ++stats_.num_underruns;
+    }
+  }
+  
+  static inline void RecordBlockDuration(uint8_t duration) {
+    if (duration > stats_.max_block_duration) {
+      stats_.max_block_duration = duration;
+    }
+  }
 
  private:
   static SpiSlave<MSB_FIRST, false> spi_;
@@ -210,9 +284,13 @@ class VoicecardProtocolRx {
   static uint8_t state_;
   static uint8_t data_size_;
   static uint8_t* data_ptr_;
-  static uint8_t arguments_[3];
+  static uint8_t arguments_[kMaxCommandArgumentsSize];
   static uint8_t rx_led_counter_;
   static uint8_t lights_out_;
+  
+  static VoicecardStats stats_;
+  static uint8_t stats_snapshot_[kVoicecardStatsSize];
+  static uint8_t stats_snapshot_index_;
    
   DISALLOW_COPY_AND_ASSIGN(VoicecardProtocolRx);
 };